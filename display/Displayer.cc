@@ -9,10 +9,16 @@
 #include "led-matrix.h"
 #include "graphics.h"
 
+#include <algorithm>
+#include <climits>  // INT_MIN
+#include <cstdint>  // UINT64_MAX
+#include <cstdlib>  // abs
 #include <ctime>    // for monitoring clock for steady scrolling
-#include <cmath>    // for fabs
+#include <cmath>    // for fabs, llround
 
-#define EXTREME_COLORS_PWM_BITS 1
+#define MAILBOX_POLL_USEC 10000             // longest the render thread sleeps before looking for a new order
+#define FRAME_PERIOD_TOLERANCE 0.05f        // relative change of the measured frame period that changes the scroll steps
+#define REPLACEMENT_CODEPOINT 0xFFFD        // what Font::DrawGlyph() draws for a character the font doesn't have
 
 using namespace rgb_matrix;
 
@@ -27,27 +33,64 @@ static void add_micros(struct timespec *accumulator, long micros) {
   }
 }
 
+static bool is_before(const struct timespec &a, const struct timespec &b) {
+  return a.tv_sec < b.tv_sec || (a.tv_sec == b.tv_sec && a.tv_nsec < b.tv_nsec);
+}
 
-Displayer::Displayer(RGBMatrix::Options& aMatrix_options, rgb_matrix::RuntimeOptions& aRuntime_opt)
-    : allowIdleMarkers(true),
-      isIdle(false),
-      isDisconnected(false),
-      markedDisconnected(false),
+// Pixels per second of a velocity of 1.0: one 'W' of the default font per second, whatever font is shown.
+static int pixels_per_velocity_unit() {
+  static const int width = SpacedFont::getDefaultFontPtr()->CharacterWidth('W');
+  return (width > 0) ? width : 10;
+}
 
-      currChangeOrder(),
-      currChangeOrderDone(true),
-      next_frame(),
 
-      x(0),
-      y(0),
-      scroll_direction(0),
-      delay_speed_usec(0),
+// Draws into one zone of a canvas: coordinates are relative to the zone, and nothing outside of it is touched
+class ZoneCanvas : public rgb_matrix::Canvas {
+  public:
+  ZoneCanvas(rgb_matrix::Canvas *aCanvas, const Displayer::ZoneRect &aRect) : canvas(aCanvas), rect(aRect) {}
 
-      last_change_time(0)
-{
+  int width() const override {return rect.width;}
+  int height() const override {return rect.height;}
 
-    next_frame.tv_sec = 0;
-    next_frame.tv_nsec = 0;
+  void SetPixel(int x, int y, uint8_t red, uint8_t green, uint8_t blue) override {
+    if (x < 0 || x >= rect.width || y < 0 || y >= rect.height) return;
+    canvas->SetPixel(rect.left + x, rect.top + y, red, green, blue);
+  }
+  void SetPixelRun(int x, int y, int length, uint8_t red, uint8_t green, uint8_t blue) override {
+    if (y < 0 || y >= rect.height) return;
+    const int first = std::max(x, 0);
+    const int last = std::min(x + length, rect.width);
+    if (first >= last) return;
+    canvas->SetPixelRun(rect.left + first, rect.top + y, last - first, red, green, blue);
+  }
+  void Clear() override {Fill(0, 0, 0);}
+  void Fill(uint8_t red, uint8_t green, uint8_t blue) override {
+    if (rect.left == 0 && rect.top == 0 && rect.width == canvas->width() && rect.height == canvas->height()) {
+      canvas->Fill(red, green, blue);   // much faster than runs
+      return;
+    }
+    for (int row = 0; row < rect.height; ++row) {
+      canvas->SetPixelRun(rect.left, rect.top + row, rect.width, red, green, blue);
+    }
+  }
+
+  private:
+  rgb_matrix::Canvas *const canvas;
+  const Displayer::ZoneRect rect;
+};
+
+
+Displayer::Displayer(RGBMatrix::Options& aMatrix_options, rgb_matrix::RuntimeOptions& aRuntime_opt)
+    : running_(false),
+      allowIdleMarkers(true),
+      isDisconnected(false),
+      isIdle(false),
+      postedChangeOrder(),
+      zones(),
+      markedDisconnected(false),
+      shownMarker(nullptr),
+      swap_frame(0)
+{
 
     displayerOK = true;
 
@@ -59,22 +102,56 @@ Displayer::Displayer(RGBMatrix::Options& aMatrix_options, rgb_matrix::RuntimeOpt
     else {
         // store RGBMatrix's default pwmbits value for future use
         defaultPWMBits = canvas->pwmbits();
+        currentPWMBits = defaultPWMBits;
+
+        // same for the busy waiting; only used as is while animating
+        refreshLimitHz = canvas->refresh_rate_limit();
+        fullBusyWaiting = canvas->busy_waiting();
 
         // Create a new canvas to be used with led_matrix_swap_on_vsync
         offscreen_canvas = canvas->CreateFrameCanvas();
-        if (offscreen_canvas == nullptr) {
+        spare_canvas = canvas->CreateFrameCanvas();
+        if (offscreen_canvas == nullptr || spare_canvas == nullptr) {
           displayerOK = false;
           fprintf(stderr, "Error creating offscreen_canvas\n");
         }
+
+        // one zone, the whole panel
+        zones.emplace_back(new Zone(ZoneRect{0, 0, canvas->width(), canvas->height()}));
+    }
+    if (zones.empty()) {    // so that the main thread methods work without a panel
+        zones.emplace_back(new Zone(ZoneRect{0, 0, 0, 0}));
     }
 }
 
-bool Displayer::isExtremeColors() const {
-    if (!displayerOK) return false;  // canvas might not be valid
+bool Displayer::setZones(const std::vector<ZoneRect>& aZones) {
+    if (!displayerOK || running_.load()) return false;
+    if (aZones.empty() || aZones.size() > MAX_ZONES) {
+      fprintf(stderr, "Need 1 to %d zones, not %zu\n", MAX_ZONES, aZones.size());
+      return false;
+    }
+    for (const ZoneRect &rect : aZones) {
+      if (rect.left < 0 || rect.top < 0 || rect.width <= 0 || rect.height <= 0
+          || rect.left + rect.width > canvas->width() || rect.top + rect.height > canvas->height()) {
+        fprintf(stderr, "Zone %d,%d,%d,%d is not on the %dx%d panel\n",
+                rect.left, rect.top, rect.width, rect.height, canvas->width(), canvas->height());
+        return false;
+      }
+    }
 
-    return (canvas->brightness() == 100
-            && FullSaturation(currChangeOrder.getForegroundColor())
-            && FullSaturation(currChangeOrder.getBackgroundColor()));
+    zones.clear();
+    for (const ZoneRect &rect : aZones) {
+      zones.emplace_back(new Zone(rect));
+    }
+    return true;
+}
+
+void Displayer::Start() {
+    if (!displayerOK) return;
+
+    running_.store(true);
+    // avoid core 3 (prefer core 0,1,2) so not on core with RGBMatrix
+    Thread::Start(0,(1<<2) | (1<<1) | (1<<0));
 }
 
 bool Displayer::FullSaturation(const Color &c) {
@@ -83,282 +160,788 @@ bool Displayer::FullSaturation(const Color &c) {
       && (c.b == 0 || c.b == 255);
 }
 
+static const rgb_matrix::Color MARK_DISCONNECTED_COLOR(0,255,0);
+static const rgb_matrix::Color MARK_IDLE_COLOR(255,0,0);
+
+// Fewest pwm bits that show the colors of the current orders, and the marker dots, exactly as the default would.
+// The markers are on the overlay, but it is shown with the bits of the frame underneath.
+uint8_t Displayer::requiredPWMBits() const {
+    uint8_t bits = 1;
+    auto require = [this, &bits](const rgb_matrix::Color &c) {
+      bits = std::max(bits, offscreen_canvas->RequiredPWMBits(c.r, c.g, c.b));
+    };
+    for (const std::unique_ptr<Zone> &zone : zones) {
+      require(zone->currChangeOrder.getForegroundColor());
+      require(zone->currChangeOrder.getBackgroundColor());
+    }
+    require(MARK_DISCONNECTED_COLOR);
+    require(MARK_IDLE_COLOR);
+    return std::min(bits, defaultPWMBits);
+}
+
+// Only the offscreen canvas changes: the frame on display keeps the bits it was drawn with, and the new
+// setting shows with the first frame drawn for it, so there is no frame of old content with the wrong bits.
 void Displayer::updatePWMBits() {
     if (!displayerOK) return;
 
-    if (isChangeOrderDone()) return;    // no work to do, so no changing the canvas settings
-
-    const uint8_t targetPWMBits = isExtremeColors() ? EXTREME_COLORS_PWM_BITS : defaultPWMBits;
-    if (canvas->pwmbits() != targetPWMBits) {
-      canvas->SetPWMBits(targetPWMBits);
-      offscreen_canvas->SetPWMBits(targetPWMBits);
+    currentPWMBits = requiredPWMBits();
+    if (offscreen_canvas->pwmbits() != currentPWMBits) {
+      offscreen_canvas->SetPWMBits(currentPWMBits);
+      for (std::unique_ptr<Zone> &zone : zones) {
+        zone->drawnTexts[offscreen_canvas].font = nullptr;
+      }
     }
 }
 
-static std::string replaceNonPrintableCharacters(std::string str, const char repl_char) {
-  // Iterate through each character in the string.
-  for (unsigned i = 0; i < str.length(); i++) {
-    // Check if the character is printable.
-    if (!isprint(str[i])) {
-      if (isatty(STDIN_FILENO)) {
-        fprintf(stderr, "Replaced %02X with %c for display", str[i], repl_char);
-      }
+void Displayer::updateBusyWaiting() {
+    if (!displayerOK) return;
 
-      str[i] = repl_char;
+    // Static content doesn't need the exact timing of busy waiting, and not the core it burns. The refresh rate
+    // stays as it is: the LEDs are only lit while they are refreshed, so a slower refresh would dim the board.
+    const bool isAnyAnimating = std::any_of(zones.begin(), zones.end(),
+                                            [](const std::unique_ptr<Zone> &zone) {return isAnimating(*zone);});
+    const bool targetBusyWaiting = isAnyAnimating && fullBusyWaiting;
+    if (targetBusyWaiting != canvas->busy_waiting()) {
+        canvas->SetBusyWaiting(targetBusyWaiting);
     }
-  }
-  return str;
 }
 
 void Displayer::startChangeOrder(const TextChangeOrder& aChangeOrder) {
-  last_change_time = std::time(nullptr);
+  postedChangeOrder = aChangeOrder;
+  if (postedChangeOrder.getZone() < 0 || postedChangeOrder.getZone() >= getNumZones()) {
+    fprintf(stderr, "No zone %d, showing in zone 0\n", postedChangeOrder.getZone());
+    postedChangeOrder.setZone(0);
+  }
+  Zone &zone = *zones[postedChangeOrder.getZone()];
+
+  // ensure text can be displayed
+  constexpr char UNPRINTABLE_CHAR_REPL = '&';
+  postedChangeOrder.replaceNonPrintableCharacters(UNPRINTABLE_CHAR_REPL);
+  zone.postedChangeOrder = postedChangeOrder;
+
+  ++zone.postedSequence;
+  if (!displayerOK) {   // nothing will render it
+    zone.doneSequence.store(zone.postedSequence);
+    return;
+  }
+
+  // hand over to the render thread; an order it has not picked up yet is superseded
+  delete zone.mailbox.exchange(new PostedOrder{postedChangeOrder, zone.postedSequence}, std::memory_order_acq_rel);
+}
+
+const TextChangeOrder& Displayer::getChangeOrder(int aZone) const {
+  if (aZone < 0 || aZone >= getNumZones()) aZone = 0;
+  return zones[aZone]->postedChangeOrder;
+}
+
+bool Displayer::isChangeOrderDone() const {
+  return std::all_of(zones.begin(), zones.end(), [](const std::unique_ptr<Zone> &zone) {
+    return zone->doneSequence.load(std::memory_order_acquire) == zone->postedSequence;
+  });
+}
+
+bool Displayer::isChangeOrderDone(int aZone) const {
+  if (aZone < 0 || aZone >= getNumZones()) aZone = 0;
+  const Zone &zone = *zones[aZone];
+  return zone.doneSequence.load(std::memory_order_acquire) == zone.postedSequence;
+}
+
+bool Displayer::isContinuousScroll() const {
+  return std::any_of(zones.begin(), zones.end(), [](const std::unique_ptr<Zone> &zone) {
+    return isContinuousScroll(zone->postedChangeOrder);
+  });
+}
+
+void Displayer::beginChangeOrder(Zone& zone, const PostedOrder& aPosted) {
+  zone.last_change_time = std::time(nullptr);
 
-  currChangeOrder = aChangeOrder;
+  TextChangeOrder &currChangeOrder = zone.currChangeOrder;
+  currChangeOrder = aPosted.order;
+  zone.currSequence = aPosted.sequence;
+  if (currChangeOrder.isRunningClock()) {   // the time now, rather than when it was received
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    currChangeOrder.updateRunningClock(now);
+  }
 
   // depending on colors and brightness, use fewer pwm bits (for faster refresh)
   updatePWMBits();
 
-  // ensure text can be displayed
-  constexpr char UNPRINTABLE_CHAR_REPL = '&';
-  currChangeOrder.setString(replaceNonPrintableCharacters(currChangeOrder.getString(), UNPRINTABLE_CHAR_REPL));
-
-  // reset scroll timing
-  next_frame.tv_sec = 0;
-  next_frame.tv_nsec = 0;
+  // reset scroll timing; the clock starts with the first frame
+  zone.scroll_start.tv_sec = 0;
+  zone.scroll_start.tv_nsec = 0;
+  zone.scroll_skipped_q16 = 0;
+  zone.scroll_frame = 0;
+  zone.scroll_frame_usec = 0;
+  zone.last_shown_position = INT_MIN;
 
-  scroll_direction = (currChangeOrder.getVelocity() <= 0) ? -1 : 1;
-  const auto speed = static_cast<float>(fabs(static_cast<double>(currChangeOrder.getVelocity())));
+  zone.scroll_direction = (currChangeOrder.getVelocity() <= 0) ? -1 : 1;
+  const double speed = fabs(static_cast<double>(currChangeOrder.getVelocity()));
+  zone.scroll_speed_q16 = std::max<int64_t>(1, llround(speed * pixels_per_velocity_unit() * 65536.0));
 
-  delay_speed_usec = (!currChangeOrder.isScrolling() || currChangeOrder.getSpacedFont().fontPtr == nullptr)
-                         ? 0
-                         : static_cast<int>(1000000.0 / speed / currChangeOrder.getSpacedFont().fontPtr->CharacterWidth('W'));
+  // get width of text, without drawing it
+  zone.text_width = currChangeOrder.getSpacedFont().fontPtr->MeasureText(
+                      currChangeOrder.getText(), currChangeOrder.getSpacedFont().letterSpacing).width;
 
   if (currChangeOrder.isScrolling()) {  // velocity not zero
     if (currChangeOrder.getVelocityIsHorizontal()) {
-      if (scroll_direction > 0) {
-        // get width of text
-        // not thread safe, since we are currently using the same offscreen_canvas we use in iota
-        const int length = rgb_matrix::DrawText(offscreen_canvas, *currChangeOrder.getSpacedFont().fontPtr,
-                                    x, y + currChangeOrder.getSpacedFont().fontPtr->baseline(),
-                                    currChangeOrder.getForegroundColor(),
-                                    nullptr,  // already filled with background color, so use transparency when drawing
-                                    currChangeOrder.getText(), currChangeOrder.getSpacedFont().letterSpacing);
-        x = -length;
+      if (zone.scroll_direction > 0) {
+        zone.x = -zone.text_width;
       }
       else {
-        x = canvas->width();
+        zone.x = zone.rect.width;
       }
 
-      y = currChangeOrder.getYOrigin();
+      zone.y = currChangeOrder.getYOrigin();
     }
     else {
       // scrolling vertically
-      x = currChangeOrder.getXOrigin();
+      zone.x = currChangeOrder.getXOrigin();
 
-      if (scroll_direction > 0) {
-        y = -currChangeOrder.getSpacedFont().fontPtr->height();
+      if (zone.scroll_direction > 0) {
+        zone.y = -currChangeOrder.getSpacedFont().fontPtr->height();
       }
       else {
-        y = canvas->height();
+        zone.y = zone.rect.height;
       }
     }
     //printf("Scrolling request... startX=%d, startY=%d, vel=%f, dir=%d, %s, %s\n",x,y,currChangeOrder.getVelocity(),scroll_direction,currChangeOrder.getVelocityIsHorizontal() ? "horizontal" : "vertical",currChangeOrder.getVelocityIsSingleScroll() ? "single" : "repeating");// DEBUG
   }
   else {
-    x = currChangeOrder.getXOrigin();
-    y = currChangeOrder.getYOrigin();
+    zone.x = currChangeOrder.getXOrigin();
+    zone.y = currChangeOrder.getYOrigin();
   }
-  setChangeDone(false);
-  isIdle = false;  // reset idle timer, regardless of whether message is blank or not (so idle markers can be re-added if appropriate)
+  zone.scroll_origin = currChangeOrder.getVelocityIsHorizontal() ? zone.x : zone.y;
+  zone.isDirty = true;
+  setChangeDone(zone, false);
+  isIdle.store(false);  // reset idle timer, regardless of whether message is blank or not (so idle markers can be re-added if appropriate)
+
+  updateBusyWaiting();  // back to busy waiting, if scrolling
 }
 
-inline void Displayer::setChangeDone(bool isChangeDone) {
-  currChangeOrderDone = isChangeDone;
-  last_change_time = std::time(nullptr);
+inline void Displayer::setChangeDone(Zone& zone, bool isChangeDone) {
+  zone.currChangeOrderDone = isChangeDone;
+  zone.last_change_time = std::time(nullptr);
+  if (zone.currChangeOrderDone) {
+    zone.doneSequence.store(zone.currSequence, std::memory_order_release);
+  }
 
-  if (currChangeOrderDone && isatty(STDIN_FILENO)) {
+  if (zone.currChangeOrderDone && isatty(STDIN_FILENO)) {
     // Only give a message if we are interactive. If connected via pipe, be quiet
-    printf("Displayed:%s\n",currChangeOrder.getText());
+    if (getNumZones() > 1) {
+      printf("Displayed in zone %d:%s\n", static_cast<int>(&zone - zones[0].get()) , zone.currChangeOrder.getText());
+    }
+    else {
+      printf("Displayed:%s\n", zone.currChangeOrder.getText());
+    }
   }
 }
 
-void Displayer::dotCorners(const rgb_matrix::Color &dotColor, rgb_matrix::Canvas *aCanvas) {
+// Marker dots are on the matrix overlay, on top of whatever is displayed: no redraw, and removing them
+// shows the content underneath again. nullptr removes them.
+void Displayer::dotCorners(const rgb_matrix::Color *dotColor) {
   //last_change_time = std::time(nullptr);  // dotting corners with markers does NOT count as "no longer idle"
 
-  aCanvas->SetPixel(0,0, dotColor.r, dotColor.g, dotColor.b);
-  aCanvas->SetPixel(0,offscreen_canvas->height()-1, dotColor.r, dotColor.g, dotColor.b);
-  aCanvas->SetPixel(offscreen_canvas->width()-1,0, dotColor.r, dotColor.g, dotColor.b);
-  aCanvas->SetPixel(offscreen_canvas->width()-1,offscreen_canvas->height()-1, dotColor.r, dotColor.g, dotColor.b);
-
+  const int corners[4][2] = {{0, 0}, {0, canvas->height()-1}, {canvas->width()-1, 0}, {canvas->width()-1, canvas->height()-1}};
+  for (const auto &corner : corners) {
+    if (dotColor != nullptr) {
+      canvas->SetOverlayPixel(corner[0], corner[1], dotColor->r, dotColor->g, dotColor->b);
+    }
+    else {
+      canvas->ClearOverlayPixel(corner[0], corner[1]);
+    }
+  }
 }
 
-void Displayer::iota() {
-  if (!displayerOK) return;
+void Displayer::Run() {
+  while (running_.load()) {
+    // pick up the newest orders, if any; the main thread never waits for this
+    for (std::unique_ptr<Zone> &zone : zones) {
+      PostedOrder *posted = zone->mailbox.exchange(nullptr, std::memory_order_acq_rel);
+      if (posted != nullptr) {
+        beginChangeOrder(*zone, *posted);
+        delete posted;
+      }
+    }
 
-  const  rgb_matrix::Color MARK_DISCONNECTED_COLOR(0,255,0); // use an extreme color to avoid messing up pwmbits
-  const  rgb_matrix::Color UNMARK_DISCONNECTED_COLOR(0,0,0); // since we can't query other dot colors, just go black
-  const  rgb_matrix::Color MARK_IDLE_COLOR(255,0,0); // use an extreme color to avoid messing up pwmbits
-  constexpr time_t SECONDS_BLANK_TO_DECLARE_IDLE = 5;
+    // running clocks tick on, once their order is shown
+    struct timespec now = {};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t to_next_tick_usec = MAILBOX_POLL_USEC;
+    bool isAnyAnimating = false;
+    bool isAnyDirty = false;
+    bool isAllDone = true;
+    for (std::unique_ptr<Zone> &zone : zones) {
+      if (!isAnimating(*zone) && zone->currChangeOrder.isRunningClock()) {
+        if (zone->currChangeOrder.updateRunningClock(now)) {
+          zone->isDirty = true;   // only the digits that changed are drawn
+        }
+        to_next_tick_usec = std::min(to_next_tick_usec, zone->currChangeOrder.usecToNextRunningClockTick(now));
+      }
+      isAnyAnimating |= isAnimating(*zone);
+      isAnyDirty |= zone->isDirty;
+      isAllDone &= zone->currChangeOrderDone;
+    }
 
-  if (!currChangeOrderDone || isContinuousScroll()) {
-    // restart idle timer unless an "empty" message is in progress (still scrolling) on the display over multiple iota calls
-    if (!currChangeOrder.orderDoneHasEmptyDisplay()) {  // non-empty message still in progress, so keep resetting the idle timer
-      isIdle = false;
+    if (isAnyAnimating || isAnyDirty) {
+      renderFrame();    // paced by the scroll clock
     }
+    if (isAllDone) {  // no active change order (although continuous scrolling may be ongoing)
+      markIdle();
+    }
+    updateMarkers();
 
-    // clear offline canvas
-    offscreen_canvas->Fill(currChangeOrder.getBackgroundColor().r,
-                           currChangeOrder.getBackgroundColor().g,
-                           currChangeOrder.getBackgroundColor().b);
+    updateBusyWaiting();  // stop busy waiting once the content is static
 
-    // draw text onto offline canvas.
-    // length = holds how many pixels our text takes up
-    const rgb_matrix::Font& currFont = *currChangeOrder.getSpacedFont().fontPtr;
-    const int currLetterSpacing = currChangeOrder.getSpacedFont().letterSpacing;
+    if (!isAnyAnimating) {
+      usleep(to_next_tick_usec);  // nothing to draw until a new order arrives, or a running clock ticks
+    }
+  }
+}
 
-    //printf("Loc(%d,%d)\n",x,y+currFont.baseline());//DEBUG
-    const int length = rgb_matrix::DrawText(offscreen_canvas, currFont,
-                                  x, y + currFont.baseline(),
-                                  currChangeOrder.getForegroundColor(),
-                                  nullptr,  // already filled with background color, so use transparency when drawing
-                                  currChangeOrder.getText(), currLetterSpacing);
+// Distance scrolled since scroll_start, in pixels with 16 fractional bits. A function of the elapsed
+// time only, so render time, late frames and the frame rate don't change where the text is.
+int64_t Displayer::scrolledQ16(const Zone& zone, const struct timespec &now) {
+  const int64_t elapsed_usec = static_cast<int64_t>(now.tv_sec - zone.scroll_start.tv_sec) * 1000000
+                               + (now.tv_nsec - zone.scroll_start.tv_nsec) / 1000;
+  return (elapsed_usec / 1000000) * zone.scroll_speed_q16 + (elapsed_usec % 1000000) * zone.scroll_speed_q16 / 1000000;
+}
 
-    // Make sure render-time delays are not influencing scroll-time
-    if (currChangeOrder.isScrolling()) {
-      if (next_frame.tv_sec == 0 && next_frame.tv_nsec == 0) {
-        // First time. Start timer, but don't wait.
-        clock_gettime(CLOCK_MONOTONIC, &next_frame);
-      } else {
-        add_micros(&next_frame, delay_speed_usec);
-        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next_frame, nullptr);
-      }
-    }
+// With the frame clock: distance scrolled per displayed frame, in 16.16 pixels. Only follows the measured
+// frame period if it changed noticeably, so that the steps stay evenly spaced.
+double Displayer::q16PerFrame(Zone& zone, float frame_usec) {
+  if (fabs(frame_usec - zone.scroll_frame_usec) > zone.scroll_frame_usec * FRAME_PERIOD_TOLERANCE) {
+    zone.scroll_frame_usec = frame_usec;
+  }
+  return static_cast<double>(zone.scroll_speed_q16) * zone.scroll_frame_usec / 1e6;
+}
 
-    // if asked, overlay "disconnected" marker dots on whatever is displayed
-    // regardless, update flag indicating whether the dots are applied
-    if (isDisconnected) {
-      dotCorners(MARK_DISCONNECTED_COLOR, offscreen_canvas);
+// With the frame clock: plan the frame the next step is shown on, the first one on which the text of a
+// scrolling zone has moved on by a pixel, but no later than MAILBOX_POLL_USEC.
+uint64_t Displayer::nextStepFrame(uint64_t frame_count, float frame_usec) {
+  const int max_frames = std::max(1, static_cast<int>(MAILBOX_POLL_USEC / frame_usec));
+  uint64_t next_frame = UINT64_MAX;
+  for (std::unique_ptr<Zone> &zone : zones) {
+    if (!isScrollingNow(*zone)) continue;
+    if (zone->scroll_frame == 0) {  // First time. Start with the next frame.
+      next_frame = frame_count + 1;
+      continue;
     }
-    markedDisconnected = isDisconnected;
+    const double q16_per_frame = q16PerFrame(*zone, frame_usec);
+    const int64_t to_next_pixel_q16 = (((zone->scroll_frame_q16 >> 16) + 1) << 16) - zone->scroll_frame_q16;
+    const int frames = std::min(max_frames, std::max(1, static_cast<int>(ceil(to_next_pixel_q16 / q16_per_frame))));
+    next_frame = std::min(next_frame, zone->scroll_frame + frames);
+  }
+  if (next_frame <= frame_count || next_frame == UINT64_MAX) {
+    next_frame = frame_count + 1;   // behind, or only static changes: the next frame
+  }
+  return next_frame;
+}
+
+// With the frame clock: the distance scrolled on the planned frame, which becomes the zone's scroll_frame
+int64_t Displayer::scrolledOnFrame(Zone& zone, uint64_t frame, float frame_usec) {
+  if (zone.scroll_frame == 0) {
+    zone.scroll_frame_q16 = 0;
+  }
+  else if (frame > zone.scroll_frame) {
+    zone.scroll_frame_q16 += llround((frame - zone.scroll_frame) * q16PerFrame(zone, frame_usec));
+  }
+  zone.scroll_frame = frame;
+  return zone.scroll_frame_q16;
+}
 
-    // Swap the offscreen_canvas with canvas on vsync, avoids flickering
-    offscreen_canvas = canvas->SwapOnVSync(offscreen_canvas);
+int Displayer::scrollPosition(const Zone& zone, int64_t scrolled_q16) {
+  return zone.scroll_origin + zone.scroll_direction * static_cast<int>((scrolled_q16 - zone.scroll_skipped_q16) >> 16);
+}
 
-    // compute next position and/or done status
-    if (currChangeOrder.isScrolling()) {
-      if (currChangeOrder.getVelocityIsHorizontal()) {
-        x += scroll_direction;  // unit magnitude
+// First position along the scroll axis that is past the end of the scroll
+int Displayer::scrollEnd(const Zone& zone) {
+  const TextChangeOrder &currChangeOrder = zone.currChangeOrder;
+  const rgb_matrix::Font& currFont = *currChangeOrder.getSpacedFont().fontPtr;
+  const bool isHorizontal = currChangeOrder.getVelocityIsHorizontal();
+
+  switch (currChangeOrder.getVelocityScrollType()) {
+    case TextChangeOrder::CONTINUOUS:   // wrap when off screen
+      if (isHorizontal) {
+        return (zone.scroll_direction < 0) ? -zone.text_width - 1 : zone.rect.width + 1;
       }
-      else {
-        y += scroll_direction;  // unit magnitude
+      return (zone.scroll_direction < 0) ? -currFont.baseline() - 1 : zone.rect.height + 1;
+
+    case TextChangeOrder::SINGLE_ON:    // stop at origin position
+      return (isHorizontal ? currChangeOrder.getXOrigin() : currChangeOrder.getYOrigin()) + zone.scroll_direction;
+
+    case TextChangeOrder::SINGLE_ONOFF: // stop when exit far side
+    default:
+      if (isHorizontal) {
+        return (zone.scroll_direction < 0) ? -zone.text_width - 1 : zone.rect.width + 1;
       }
+      return (zone.scroll_direction < 0) ? -currFont.height() - 1 : zone.rect.height + 1;
+  }
+}
 
+// Without the frame clock: time until the text of a scrolling zone moves on by a pixel, or a running clock
+// ticks, but not less than a panel frame.
+int64_t Displayer::usecToNextStep(const struct timespec &now) const {
+  int64_t wait_usec = 1000000;  // position is re-checked anyway
+  for (const std::unique_ptr<Zone> &zone : zones) {
+    if (isScrollingNow(*zone)) {
+      const int64_t scrolled = scrolledQ16(*zone, now) - zone->scroll_skipped_q16;
+      const int64_t to_next_pixel_q16 = (((scrolled >> 16) + 1) << 16) - scrolled;
+      wait_usec = std::min(wait_usec, (to_next_pixel_q16 * 1000000 + zone->scroll_speed_q16 - 1) / zone->scroll_speed_q16);
+    }
+    else if (zone->currChangeOrder.isRunningClock()) {
+      wait_usec = std::min(wait_usec, zone->currChangeOrder.usecToNextRunningClockTick(now));
+    }
+  }
+  return std::max(wait_usec, frameIntervalUsec());    // no point in more frames than the panel shows
+}
 
-      // handle scrolling
-      switch (currChangeOrder.getVelocityScrollType()) {
-        case TextChangeOrder::CONTINUOUS:
-          // handle wrapping
-          if (currChangeOrder.getVelocityIsHorizontal()) {
-            // wrap while scrolling horizontal
-            if ((scroll_direction < 0 && x + length < 0) ||
-               (scroll_direction > 0 && x > canvas->width())) {
-              x = currChangeOrder.getXOrigin() + ((scroll_direction > 0) ? -length : canvas->width());
-              if (!currChangeOrderDone) setChangeDone();  // completed at least one cycle of scrolling
-            }
-          }
-          else {
-            // wrap while scrolling vertical
-            if ((scroll_direction < 0 && y + currFont.baseline() < 0) ||
-               (scroll_direction > 0 && y > canvas->height())) {
-              y = currChangeOrder.getYOrigin() + ((scroll_direction > 0) ? -currFont.height() : canvas->height());
-              if (!currChangeOrderDone) setChangeDone();  // completed at least one cycle of scrolling
-            }
-          }
-          break;
+// Without the frame clock: sleep for wait_usec. Sleeps in slices, so that a new order or a Stop() isn't held up
+// by a slow scroll.
+void Displayer::waitForNextStep(const struct timespec &now, int64_t wait_usec) {
+  struct timespec deadline = now;
+  add_micros(&deadline, static_cast<long>(wait_usec));
+  struct timespec t = now;
+  while (is_before(t, deadline) && isMailboxEmpty() && running_.load()) {
+    struct timespec wake = t;
+    add_micros(&wake, MAILBOX_POLL_USEC);
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, is_before(wake, deadline) ? &wake : &deadline, nullptr);
+    clock_gettime(CLOCK_MONOTONIC, &t);
+  }
+}
 
-        case TextChangeOrder::SINGLE_ON:
-          if (currChangeOrder.getVelocityIsHorizontal()) {
-            // stop horizontal scroll when reach origin position
-            if ((scroll_direction < 0 && x < currChangeOrder.getXOrigin()) ||
-                (scroll_direction > 0 && x > currChangeOrder.getXOrigin())) {
-              x = currChangeOrder.getXOrigin();
-              setChangeDone();
-            }
-          }
-          else {
-            // stop vertical scroll when reach origin position
-            if ((scroll_direction < 0 && y < currChangeOrder.getYOrigin()) ||
-                (scroll_direction > 0 && y > currChangeOrder.getYOrigin())) {
-              y = currChangeOrder.getYOrigin();
-              setChangeDone();
-            }
-          }
-          break;
+bool Displayer::isMailboxEmpty() const {
+  return std::all_of(zones.begin(), zones.end(), [](const std::unique_ptr<Zone> &zone) {
+    return zone->mailbox.load(std::memory_order_relaxed) == nullptr;
+  });
+}
 
-        case TextChangeOrder::SINGLE_ONOFF:
+// Time the panel takes to show a frame; 0 if not known
+int64_t Displayer::frameIntervalUsec() const {
+  if (refreshLimitHz > 0) {
+    return 1000000 / refreshLimitHz;
+  }
+  rgb_matrix::RGBMatrix::RefreshStats stats;
+  if (canvas->GetRefreshStats(&stats)) {
+    return stats.last_frame_usec;
+  }
+  return 0;
+}
+
+// Move the text of a scrolling zone to its position on the frame to be shown; positions passed since the previous
+// frame are skipped. Returns what happened, ScrollStep flags.
+int Displayer::scrollStep(Zone& zone, bool isFrameClock, uint64_t frame, float frame_usec, const struct timespec &now) {
+    const TextChangeOrder &currChangeOrder = zone.currChangeOrder;
+    const rgb_matrix::Font& currFont = *currChangeOrder.getSpacedFont().fontPtr;
+    int step = STEP_NONE;
+
+    int64_t scrolled_q16;
+    if (isFrameClock) {
+      scrolled_q16 = scrolledOnFrame(zone, frame, frame_usec);
+    }
+    else {
+      if (zone.scroll_start.tv_sec == 0 && zone.scroll_start.tv_nsec == 0) {
+        zone.scroll_start = now;   // First time. Start the clock.
+      }
+      scrolled_q16 = scrolledQ16(zone, now);
+    }
+    int &position = currChangeOrder.getVelocityIsHorizontal() ? zone.x : zone.y;
+    position = scrollPosition(zone, scrolled_q16);
+
+    const int end = scrollEnd(zone);
+    auto isPastEnd = [&](int aPosition) {
+      return (zone.scroll_direction < 0) ? aPosition <= end : aPosition >= end;
+    };
+    switch (currChangeOrder.getVelocityScrollType()) {
+      case TextChangeOrder::CONTINUOUS:
+        // handle wrapping: start over from the other side, keeping the distance scrolled past the end.
+        // After a long stall this might go around more than once.
+        while (isPastEnd(position)) {
+          zone.scroll_skipped_q16 += static_cast<int64_t>(std::max(1, abs(end - zone.scroll_origin))) << 16;
           if (currChangeOrder.getVelocityIsHorizontal()) {
-            // stop horizontal scroll when exit far side
-            if ((scroll_direction < 0 && x < -length) ||
-                (scroll_direction > 0 && x > canvas->width())) {
-              x = canvas->width()+1;  // off screen
-              setChangeDone();
-            }
+            zone.scroll_origin = currChangeOrder.getXOrigin() + ((zone.scroll_direction > 0) ? -zone.text_width : zone.rect.width);
           }
           else {
-            // stop vertical scroll when exit top or bottom
-            if ((scroll_direction < 0 && y < -currFont.height()) ||
-                (scroll_direction > 0 && y > canvas->height())) {
-              y = canvas->height()+1; // off screen
-              setChangeDone();
-            }
+            zone.scroll_origin = currChangeOrder.getYOrigin() + ((zone.scroll_direction > 0) ? -currFont.height() : zone.rect.height);
           }
+          position = scrollPosition(zone, scrolled_q16);
+          step |= STEP_WRAPPED;
+        }
+        break;
+
+      case TextChangeOrder::SINGLE_ON:
+        if (isPastEnd(position)) {
+          position = currChangeOrder.getVelocityIsHorizontal() ? currChangeOrder.getXOrigin() : currChangeOrder.getYOrigin();
+          step |= STEP_FINISHED;
+        }
+        break;
+
+      case TextChangeOrder::SINGLE_ONOFF:
+        if (isPastEnd(position)) {
+          position = currChangeOrder.getVelocityIsHorizontal() ? zone.rect.width+1 : zone.rect.height+1;  // off screen
+          step |= STEP_FINISHED;
+        }
+        break;
+
+      default:
+        //no action
         break;
+    }
+
+    if (position != zone.last_shown_position) {
+      step |= STEP_MOVED;
+    }
+    zone.last_shown_position = position;
+    return step;
+}
+
+// Fill the zone and draw its text at the current scroll position
+void Displayer::drawScrolling(Zone& zone) {
+    const TextChangeOrder &currChangeOrder = zone.currChangeOrder;
+    const rgb_matrix::Font& currFont = *currChangeOrder.getSpacedFont().fontPtr;
+    ZoneCanvas zoneCanvas(offscreen_canvas, zone.rect);
+
+    // clear offline canvas
+    zoneCanvas.Fill(currChangeOrder.getBackgroundColor().r,
+                    currChangeOrder.getBackgroundColor().g,
+                    currChangeOrder.getBackgroundColor().b);
+
+    // draw text onto offline canvas.
+    //printf("Loc(%d,%d)\n",x,y+currFont.baseline());//DEBUG
+    rgb_matrix::DrawText(&zoneCanvas, currFont,
+                         zone.x, zone.y + currFont.baseline(),
+                         currChangeOrder.getForegroundColor(),
+                         nullptr,  // already filled with background color, so use transparency when drawing
+                         currChangeOrder.getText(), currChangeOrder.getSpacedFont().letterSpacing);
+    zone.drawnTexts[offscreen_canvas].font = nullptr;
+}
+
+void Displayer::renderFrame() {
+    // If the matrix is refreshing, scroll in displayed frames: every step is swapped in on the frame it is
+    // meant for. Otherwise, go by the monotonic clock.
+    uint64_t frame_count = 0;
+    float frame_usec = 0;
+    const bool isFrameClock = canvas->GetFrameClock(&frame_count, &frame_usec) && frame_usec > 0;
+    struct timespec now = {};
+    uint64_t next_frame = 0;
+    if (isFrameClock) {
+      next_frame = nextStepFrame(frame_count, frame_usec);
+    }
+    else {
+      clock_gettime(CLOCK_MONOTONIC, &now);
+    }
+    // frames since the previous swap; the matrix counts them from there
+    const unsigned swap_frames = (swap_frame != 0 && next_frame > frame_count + 1) ? next_frame - swap_frame : 1;
+
+    // what changed in each zone
+    int steps[MAX_ZONES] = {};
+    bool isChanged = false;
+    bool isAnyScrollingNow = false;
+    for (size_t i = 0; i < zones.size(); ++i) {
+      Zone &zone = *zones[i];
+      if (isScrollingNow(zone)) {
+        isAnyScrollingNow = true;
+        steps[i] = scrollStep(zone, isFrameClock, next_frame, frame_usec, now);
+        if (steps[i] == STEP_NONE) continue;
+        isChanged = true;
+        if (!(steps[i] & STEP_FINISHED)) continue;
+        zone.isDirty = true;    // stays where it finished
+      }
+      if (zone.isDirty) {
+        zone.layout = layoutText(zone);
+        zone.isDirty = false;
+      }
+      if (!isSameContent(zone.drawnTexts[offscreen_canvas], zone.layout)) {
+        isChanged = true;
+      }
+    }
+
+    if (!isChanged) {
+      // repeat the positions on screen: nothing to draw, but a static order that shows what is shown is done
+      for (std::unique_ptr<Zone> &zone : zones) {
+        if (!zone->currChangeOrderDone && !zone->currChangeOrder.isScrolling()) {
+          setChangeDone(*zone);
+        }
+      }
+      if (!isAnyScrollingNow) return;    // e.g. a running clock ticked, but shows the same text
+      if (isFrameClock) {
+        canvas->SwapOnVSync(nullptr, swap_frames);
+        swap_frame = next_frame;
+        catchUpFrameClock();
+      }
+      else {
+        waitForNextStep(now, usecToNextStep(now));
+      }
+      return;
+    }
+
+    bool isAnyScrolling = false;
+    for (size_t i = 0; i < zones.size(); ++i) {
+      Zone &zone = *zones[i];
+      // restart idle timer unless an "empty" message is in progress (still scrolling) on the display over multiple frames
+      if (!zone.currChangeOrder.orderDoneHasEmptyDisplay()) {  // non-empty message still in progress, so keep resetting the idle timer
+        isIdle.store(false);
+      }
+      if (isScrollingNow(zone) && !(steps[i] & STEP_FINISHED)) {
+        drawScrolling(zone);
+        isAnyScrolling = true;
+      }
+      else {
+        drawText(zone, zone.layout);   // e.g. a running time: only the digits that changed; nothing if unchanged
+      }
+    }
+    const rgb_matrix::FrameCanvas *shown = offscreen_canvas;
+
+    // Show the offscreen_canvas on vsync, avoids flickering.
+    if (isFrameClock) {
+      // on the planned frame; the frame clock paces us
+      offscreen_canvas = canvas->SwapOnVSync(offscreen_canvas, swap_frames);
+      swap_frame = next_frame;
+      if (isAnyScrolling) catchUpFrameClock();
+    }
+    else {
+      // Don't wait for the vsync: the scroll clock paces us. The returned canvas is not shown anymore;
+      // NULL only the first time.
+      rgb_matrix::FrameCanvas *free_canvas = canvas->TrySwapOnVSync(offscreen_canvas);
+      offscreen_canvas = (free_canvas != nullptr) ? free_canvas : spare_canvas;
+    }
+    if (offscreen_canvas->pwmbits() != currentPWMBits) {
+      offscreen_canvas->SetPWMBits(currentPWMBits);  // drawn for a previous order
+      for (std::unique_ptr<Zone> &zone : zones) {
+        zone->drawnTexts[offscreen_canvas].font = nullptr;
+      }
+    }
 
-        default:
-          //no action
+    for (size_t i = 0; i < zones.size(); ++i) {
+      Zone &zone = *zones[i];
+      if (!zone.currChangeOrderDone
+          && (!zone.currChangeOrder.isScrolling() || (steps[i] & (STEP_FINISHED | STEP_WRAPPED)))) {
+        setChangeDone(zone);  // text appeared, or continuous: completed at least one cycle of scrolling
+      }
+      if (!isScrollingNow(zone)) {
+        syncOffscreen(zone, shown);
+      }
+    }
+    if (isAnyScrolling && !isFrameClock) {
+      waitForNextStep(now, usecToNextStep(now));
+    }
+}
+
+static bool isSameColor(const rgb_matrix::Color &a, const rgb_matrix::Color &b) {
+  return a.r == b.r && a.g == b.g && a.b == b.b;
+}
+
+// true if "b" can be drawn over "a" glyph by glyph
+bool Displayer::isSameStyle(const DrawnText &a, const DrawnText &b) {
+    return a.font != nullptr && a.font == b.font && isSameColor(a.foreground, b.foreground)
+           && isSameColor(a.background, b.background) && a.baseline == b.baseline;
+}
+
+bool Displayer::isSameContent(const DrawnText &a, const DrawnText &b) {
+    return isSameStyle(a, b) && a.glyphs.size() == b.glyphs.size()
+           && std::equal(a.glyphs.begin(), a.glyphs.end(), b.glyphs.begin(),
+                         [](const DrawnGlyph &ga, const DrawnGlyph &gb) {
+                           return ga.x == gb.x && ga.codepoint == gb.codepoint;
+                         });
+}
+
+// The glyphs of the zone's text where DrawText() puts them. The text is ASCII, see
+// TextChangeOrder::replaceNonPrintableCharacters(), so every byte is a glyph.
+Displayer::DrawnText Displayer::layoutText(const Zone& zone) const {
+    const TextChangeOrder &currChangeOrder = zone.currChangeOrder;
+    DrawnText text;
+    text.font = currChangeOrder.getSpacedFont().fontPtr;
+    text.foreground = currChangeOrder.getForegroundColor();
+    text.background = currChangeOrder.getBackgroundColor();
+    text.baseline = zone.y + text.font->baseline();
+
+    const int letterSpacing = currChangeOrder.getSpacedFont().letterSpacing;
+    const rgb_matrix::TextMetrics metrics = text.font->MeasureText(currChangeOrder.getText(), letterSpacing);
+    text.inkTop = zone.y + metrics.ink_y;
+    text.inkBottom = text.inkTop + metrics.ink_height;
+    int glyphX = zone.x;
+    for (const char *c = currChangeOrder.getText(); *c != '\0'; ++c) {
+      const uint32_t codepoint = static_cast<unsigned char>(*c);
+      int width = text.font->CharacterWidth(codepoint);
+      if (width < 0) width = text.font->CharacterWidth(REPLACEMENT_CODEPOINT);
+      if (width < 0) width = 0;     // nothing drawn
+      text.glyphs.push_back({glyphX, width, codepoint});
+      glyphX += width + letterSpacing;
+    }
+    return text;
+}
+
+// Columns [first, second) in which a canvas showing "from" differs from "to": the cells of the glyphs only one
+// of them has. A glyph draws nothing outside of its cell (its width, the ink rows), so the rest is the same.
+void Displayer::changedSpans(const DrawnText &from, const DrawnText &to, std::vector<std::pair<int, int>> *spans) {
+    spans->clear();
+    auto addOnlyIn = [spans](const std::vector<DrawnGlyph> &glyphs, const std::vector<DrawnGlyph> &others) {
+      for (size_t i = 0; i < glyphs.size(); ++i) {
+        const DrawnGlyph &glyph = glyphs[i];
+        if (glyph.width <= 0) continue;
+        auto isSame = [&glyph](const DrawnGlyph &other) {
+          return other.x == glyph.x && other.codepoint == glyph.codepoint;
+        };
+        if (i < others.size() && isSame(others[i])) continue;     // usually at the same place in the text
+        if (std::any_of(others.begin(), others.end(), isSame)) continue;
+        spans->emplace_back(glyph.x, glyph.x + glyph.width);
+      }
+    };
+    addOnlyIn(to.glyphs, from.glyphs);
+    addOnlyIn(from.glyphs, to.glyphs);
+
+    // merge overlapping and adjacent spans
+    std::sort(spans->begin(), spans->end());
+    size_t merged = 0;
+    for (const std::pair<int, int> &span : *spans) {
+      if (merged > 0 && span.first <= (*spans)[merged - 1].second) {
+        (*spans)[merged - 1].second = std::max((*spans)[merged - 1].second, span.second);
+      }
+      else {
+        (*spans)[merged++] = span;
+      }
+    }
+    spans->resize(merged);
+}
+
+// Draw a static text in its zone of the offscreen canvas. If the zone shows a text of the same font, colors and
+// baseline, only the columns of the glyphs that changed are cleared and drawn again; nothing if none did.
+void Displayer::drawText(Zone& zone, const DrawnText &text) {
+    DrawnText &drawn = zone.drawnTexts[offscreen_canvas];
+    ZoneCanvas zoneCanvas(offscreen_canvas, zone.rect);
+    if (!isSameStyle(drawn, text)) {
+      zoneCanvas.Fill(text.background.r, text.background.g, text.background.b);
+      rgb_matrix::DrawText(&zoneCanvas, *text.font, zone.x, text.baseline, text.foreground,
+                           nullptr,  // already filled with background color, so use transparency when drawing
+                           zone.currChangeOrder.getText(), zone.currChangeOrder.getSpacedFont().letterSpacing);
+      drawn = text;
+      return;
+    }
+
+    std::vector<std::pair<int, int>> spans;
+    changedSpans(drawn, text, &spans);
+    const int top = std::min(drawn.inkTop, text.inkTop);
+    const int bottom = std::max(drawn.inkBottom, text.inkBottom);
+    for (const std::pair<int, int> &span : spans) {
+      for (int row = top; row < bottom; ++row) {    // clipped to the zone
+        zoneCanvas.SetPixelRun(span.first, row, span.second - span.first, text.background.r, text.background.g, text.background.b);
+      }
+    }
+    // every glyph reaching into a cleared span, also unchanged ones overlapping it with a negative letter spacing
+    for (const DrawnGlyph &glyph : text.glyphs) {
+      for (const std::pair<int, int> &span : spans) {
+        if (glyph.x < span.second && glyph.x + glyph.width > span.first) {
+          text.font->DrawGlyph(&zoneCanvas, glyph.x, text.baseline, text.foreground, nullptr, glyph.codepoint);
           break;
+        }
+      }
+    }
+    drawn = text;
+}
+
+// After a static text was swapped in: bring the zone of the canvas now offscreen up to date with it, copying
+// only what differs, so that the next text only draws its own changes.
+void Displayer::syncOffscreen(Zone& zone, const rgb_matrix::FrameCanvas *shown) {
+    if (offscreen_canvas == shown) return;
+    const DrawnText &shownText = zone.drawnTexts[shown];
+    DrawnText &drawn = zone.drawnTexts[offscreen_canvas];
+    if (!isSameContent(shownText, zone.layout) || isSameContent(drawn, shownText)) return;
+
+    const ZoneRect &rect = zone.rect;
+    if (!isSameStyle(drawn, shownText)) {
+      if (rect.left == 0 && rect.top == 0 && rect.width == canvas->width() && rect.height == canvas->height()) {
+        offscreen_canvas->CopyFrom(*shown);
+      }
+      else {
+        offscreen_canvas->CopyFrom(*shown, rect.left, rect.top, rect.width, rect.height);
       }
     }
     else {
-      // Text appeared.  Done.
-      setChangeDone();
+      std::vector<std::pair<int, int>> spans;
+      changedSpans(drawn, shownText, &spans);
+      const int top = std::max(std::min(drawn.inkTop, shownText.inkTop), 0);
+      const int bottom = std::min(std::max(drawn.inkBottom, shownText.inkBottom), rect.height);
+      for (const std::pair<int, int> &span : spans) {
+        const int first = std::max(span.first, 0);
+        const int last = std::min(span.second, rect.width);
+        if (first >= last || top >= bottom) continue;
+        offscreen_canvas->CopyFrom(*shown, rect.left + first, rect.top + top, last - first, bottom - top);
+      }
+    }
+    drawn = shownText;
+}
+
+// With the frame clock, after a swap: if it was shown later than planned, the next positions catch up
+void Displayer::catchUpFrameClock() {
+  uint64_t frame_count;
+  float frame_usec;
+  if (!canvas->GetFrameClock(&frame_count, &frame_usec) || frame_count + 1 <= swap_frame) return;
+
+  for (std::unique_ptr<Zone> &zone : zones) {
+    if (isScrollingNow(*zone) && zone->scroll_frame != 0) {
+      scrolledOnFrame(*zone, frame_count + 1, frame_usec);
     }
   }
+  swap_frame = frame_count + 1;
+}
 
-  if (currChangeOrderDone) {  // no active change order (although continuous scrolling may be ongoing)
-    // if requested, and idled with blank display for length of time, mark dots on corners
-    if (allowIdleMarkers
-        && !isIdle
-        && currChangeOrder.orderDoneHasEmptyDisplay()
+void Displayer::markIdle() {
+    constexpr time_t SECONDS_BLANK_TO_DECLARE_IDLE = 5;
+
+    // if requested, and idled with blank display (in every zone) for length of time, mark dots on corners
+    std::time_t last_change_time = 0;
+    bool isEmptyDisplay = true;
+    for (const std::unique_ptr<Zone> &zone : zones) {
+      last_change_time = std::max(last_change_time, zone->last_change_time);
+      isEmptyDisplay &= zone->currChangeOrder.orderDoneHasEmptyDisplay();
+    }
+    if (allowIdleMarkers.load()
+        && !isIdle.load()
+        && isEmptyDisplay
         && std::time(nullptr) - last_change_time >= SECONDS_BLANK_TO_DECLARE_IDLE) {
 
-      isIdle = true;
-      dotCorners(MARK_IDLE_COLOR, canvas);  // directly change display to show dots
+      isIdle.store(true);
       if (isatty(STDIN_FILENO)) {
         // Only give a message if we are interactive. If connected via pipe, be quiet
         printf("Idle marked\n");
       }
 
     }
+}
+
+// Show the marker dots that apply now; "disconnected" takes precedence over "idle"
+void Displayer::updateMarkers() {
+    const bool isMarkDisconnected = isDisconnected.load();
+    const rgb_matrix::Color *marker = nullptr;
+    if (isMarkDisconnected) {
+      marker = &MARK_DISCONNECTED_COLOR;
+    }
+    else if (isIdle.load() && allowIdleMarkers.load()) {
+      marker = &MARK_IDLE_COLOR;
+    }
+    if (marker != shownMarker) {
+      dotCorners(marker);
+      shownMarker = marker;
+    }
 
-    // if change in whether disconnected dots should be visible, update display and internal flag indicating presence of dots
-    if (isDisconnected != markedDisconnected) {
-      // apply new dot color over the top of whatever was displayed
-      const rgb_matrix::Color applyColor = isDisconnected ? MARK_DISCONNECTED_COLOR : UNMARK_DISCONNECTED_COLOR;
-      dotCorners(applyColor, canvas);  // directly change display to show new dot color
-      markedDisconnected = isDisconnected;
+    if (isMarkDisconnected != markedDisconnected) {
+      markedDisconnected = isMarkDisconnected;
       if (isatty(STDIN_FILENO)) {
         // Only give a message if we are interactive. If connected via pipe, be quiet
         printf("Known disconnected marked\n");
       }
     }
-  }
 }
 
 Displayer::~Displayer() {
+  Stop();
+  WaitStopped();
+  for (std::unique_ptr<Zone> &zone : zones) {
+    delete zone->mailbox.load();
+  }
+
   // Finished. Shut down the RGB matrix.
+  if (canvas == nullptr) return;
   canvas->Clear();
   delete canvas;
 }
-
-
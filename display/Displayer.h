@@ -7,62 +7,209 @@
 
 #include "led-matrix.h"
 #include "graphics.h"   // Color
+#include "thread.h"
 #include "TextChangeOrder.h"
 
+#include <atomic>
 #include <ctime>        // timespec
+#include <map>
+#include <memory>     // unique_ptr
+#include <vector>
 
-class Displayer {
+// Change orders are rendered on the Displayer's own thread, against an absolute-deadline frame schedule.
+// The public methods are for the main thread and never wait on rendering: orders are handed over
+// through a lock-free mailbox, and done/idle state is published through atomics.
+//
+// The panel is laid out in zones, rectangles that each show their own change order with their own scroll state;
+// by default one zone covers the whole panel. An order goes to the zone it names. All zones are composited into
+// one frame per swap, and only what changed is drawn.
+class Displayer : public rgb_matrix::Thread {
     public:
+    static constexpr int MAX_ZONES = 10;    // zone numbers are one digit in the UPLC format
+
+    struct ZoneRect {
+        int left;
+        int top;
+        int width;
+        int height;
+    };
+
     Displayer(rgb_matrix::RGBMatrix::Options& aMatrix_options, rgb_matrix::RuntimeOptions& aRuntime_opt);
-    ~Displayer();
+    ~Displayer() override;
+
+    // replaces the zones, before Start(); false if there are none or too many, or one is not on the panel
+    bool setZones(const std::vector<ZoneRect>& aZones);
+    [[nodiscard]] int getNumZones() const {return static_cast<int>(zones.size());}
+
+    virtual void Start();   // start rendering; nothing is displayed before
+    void Stop() {running_.store(false);}    // render thread returns at its next frame
 
     [[nodiscard]] bool isDisplayerOK() const {return displayerOK;}
     [[nodiscard]] bool isMatrixAttached() const;
 
     static bool FullSaturation(const rgb_matrix::Color &c);
 
+    // posts the order to its zone, replacing any not yet picked up there; an unknown zone falls back to zone 0
     void startChangeOrder(const TextChangeOrder& aChangeOrder);
-    [[nodiscard]] const TextChangeOrder& getChangeOrder() const {return currChangeOrder;}
-    [[nodiscard]] bool isChangeOrderDone() const { return currChangeOrderDone; }    // true if done or continuous scroll completed at least once
-    [[nodiscard]] bool isContinuousScroll() const {return currChangeOrder.isScrolling() && currChangeOrder.getVelocityScrollType() == TextChangeOrder::CONTINUOUS;}
+    [[nodiscard]] const TextChangeOrder& getChangeOrder() const {return postedChangeOrder;}   // last posted order
+    [[nodiscard]] const TextChangeOrder& getChangeOrder(int aZone) const;   // last posted order of a zone
+    [[nodiscard]] bool isChangeOrderDone() const;   // true if done or continuous scroll completed at least once, in all zones
+    [[nodiscard]] bool isChangeOrderDone(int aZone) const;  // same, in one zone; an unknown zone counts as zone 0
+    [[nodiscard]] bool isContinuousScroll() const;  // in any zone
 
-    void iota();    // continue working on any previously assigned task, then return (non-blocking)
+    void setAllowIdleMarkers(bool isAllow) {allowIdleMarkers.store(isAllow);}
+    [[nodiscard]] int getAllowIdleMarkers() const {return allowIdleMarkers.load();}
+    [[nodiscard]] int getMarkedIdle() const {return isIdle.load();}
 
-    void setAllowIdleMarkers(bool isAllow) {allowIdleMarkers = isAllow;}
-    [[nodiscard]] int getAllowIdleMarkers() const {return allowIdleMarkers;}
-    [[nodiscard]] int getMarkedIdle() const {return isIdle;}
+    void setMarkDisconnected(bool aIsDisconnected) {isDisconnected.store(aIsDisconnected);}
+    [[nodiscard]] int getMarkDisconnected() const {return isDisconnected.load();}
 
-    void setMarkDisconnected(bool aIsDisconnected) {isDisconnected = aIsDisconnected;}
-    [[nodiscard]] int getMarkDisconnected() const {return isDisconnected;}
+    // panel health: refresh statistics of the matrix; false if not refreshing
+    [[nodiscard]] bool getRefreshStats(rgb_matrix::RGBMatrix::RefreshStats *stats) const {
+        return displayerOK && canvas->GetRefreshStats(stats);
+    }
 
     private:
+    // a change order in the mailbox, with the sequence number it was posted as
+    struct PostedOrder {
+        TextChangeOrder order;
+        unsigned sequence;
+    };
+
+    // static text as drawn in a zone of a canvas, so that the next static text only redraws the glyphs that differ.
+    // Coordinates are relative to the zone.
+    struct DrawnGlyph {
+        int x;
+        int width;
+        uint32_t codepoint;
+    };
+    struct DrawnText {
+        const rgb_matrix::Font *font = nullptr;     // nullptr if the content of the zone is not known
+        rgb_matrix::Color foreground;
+        rgb_matrix::Color background;
+        int baseline = 0;
+        int inkTop = 0;         // rows [inkTop, inkBottom) have all pixels the glyphs set
+        int inkBottom = 0;
+        std::vector<DrawnGlyph> glyphs;
+    };
+
+    // a rectangle of the panel showing its own change orders
+    struct Zone {
+        explicit Zone(const ZoneRect& aRect) : rect(aRect) {}
+        const ZoneRect rect;
+
+        // written by the main thread, read by the render thread
+        std::atomic<PostedOrder*> mailbox{nullptr};     // owned; nullptr when the render thread has picked up the last order
+
+        // written by the render thread, read by the main thread
+        std::atomic<unsigned> doneSequence{0};  // sequence of the last posted order that is done
+
+        // only used by the main thread
+        TextChangeOrder postedChangeOrder;
+        unsigned postedSequence = 0;
+
+        // everything below is only used by the render thread
+        TextChangeOrder currChangeOrder;
+        unsigned currSequence = 0;
+        bool currChangeOrderDone = true;
+        bool isDirty = true;        // layout is out of date: new order, or the running clock ticked
+        DrawnText layout;           // what the zone shows when it is not scrolling
+        std::map<const rgb_matrix::FrameCanvas*, DrawnText> drawnTexts;   // what each canvas shows in the zone, if known
+
+        // current parameters of display, relevant when velocity is not zero
+        struct timespec scroll_start = {};  // without the frame clock: time the scroll started, zero before the first frame
+        int64_t scroll_speed_q16 = 0;       // pixels per second, 16.16 fixed point
+        int64_t scroll_skipped_q16 = 0;     // distance already accounted for by wrapping around
+        uint64_t scroll_frame = 0;          // with the frame clock: frame showing the last position, 0 before the first
+        int64_t scroll_frame_q16 = 0;       // distance scrolled on scroll_frame
+        float scroll_frame_usec = 0;        // frame period the distance per frame is based on
+        int scroll_origin = 0;              // position along the scroll axis the distance counts from
+        int last_shown_position = 0;
+        int text_width = 0;
+        int x = 0;                          // text origin, relative to the zone
+        int y = 0;
+        int scroll_direction = 0;
+
+        std::time_t last_change_time = 0;   // seconds since epoch (C++17)
+    };
+
+    // what a scroll step did to a zone
+    enum ScrollStep {
+        STEP_NONE = 0,
+        STEP_MOVED = 1,
+        STEP_FINISHED = 2,
+        STEP_WRAPPED = 4
+    };
+
+    void Run() override;
+
     bool displayerOK;   // if false, every method should presume other attributes are suspect (e.g. canvas NULL)
-    bool allowIdleMarkers;  // mark dots on display when display has been blank for several seconds
-    bool isIdle;            // true if "idle" timeout has occurred and idle markers are allowed
-    bool isDisconnected;    // mark dots (different color) on display to report no messaging connection
-    bool markedDisconnected;    // true if "disconnect" dots have been marked
 
-    uint8_t defaultPWMBits;
-    rgb_matrix::RGBMatrix *canvas;
-    rgb_matrix::FrameCanvas *offscreen_canvas;
+    // written by the main thread, read by the render thread
+    std::atomic<bool> running_;
+    std::atomic<bool> allowIdleMarkers;     // mark dots on display when display has been blank for several seconds
+    std::atomic<bool> isDisconnected;       // mark dots (different color) on display to report no messaging connection
 
-    TextChangeOrder currChangeOrder;
-    bool currChangeOrderDone;
+    // written by the render thread, read by the main thread
+    std::atomic<bool> isIdle;               // true if "idle" timeout has occurred and idle markers are allowed
 
-    // current parameters of display, relevant when velocity is not zero
-    struct timespec next_frame;
-    int x;
-    int y;
-    int scroll_direction;
-    int delay_speed_usec;
+    // only used by the main thread
+    TextChangeOrder postedChangeOrder;
 
-    std::time_t last_change_time;   // seconds since epoch (C++17)
+    // set up before Start(); the zones themselves have state for both threads
+    std::vector<std::unique_ptr<Zone>> zones;
+
+    // everything below is only used by the render thread
+    bool markedDisconnected;    // true if "disconnect" dots have been marked
+    const rgb_matrix::Color *shownMarker;   // color of the marker dots on the overlay, nullptr if none
 
-    [[nodiscard]] bool isExtremeColors() const;
+    uint8_t defaultPWMBits;
+    uint8_t currentPWMBits;     // of the frames drawn for the current orders
+    int refreshLimitHz;         // from the matrix options; <= 0 is no limit
+    bool fullBusyWaiting;       // from the matrix options
+    rgb_matrix::RGBMatrix *canvas;
+    rgb_matrix::FrameCanvas *offscreen_canvas;
+    rgb_matrix::FrameCanvas *spare_canvas;  // third buffer, used once TrySwapOnVSync() has no free canvas yet
+    uint64_t swap_frame;        // with the frame clock: frame the last swap was planned for, 0 before the first
+
+    static bool isContinuousScroll(const TextChangeOrder& aChangeOrder) {
+        return aChangeOrder.isScrolling() && aChangeOrder.getVelocityScrollType() == TextChangeOrder::CONTINUOUS;
+    }
+    static bool isAnimating(const Zone& aZone) {
+        return !aZone.currChangeOrderDone || isContinuousScroll(aZone.currChangeOrder);
+    }
+    static bool isScrollingNow(const Zone& aZone) {  // drawn anew every step
+        return isAnimating(aZone) && aZone.currChangeOrder.isScrolling();
+    }
+    [[nodiscard]] uint8_t requiredPWMBits() const;
+    void beginChangeOrder(Zone& zone, const PostedOrder& aPosted);
+    void renderFrame();
+    int scrollStep(Zone& zone, bool isFrameClock, uint64_t frame, float frame_usec, const struct timespec &now);
+    void drawScrolling(Zone& zone);
+    [[nodiscard]] DrawnText layoutText(const Zone& zone) const;
+    static bool isSameStyle(const DrawnText &a, const DrawnText &b);
+    static bool isSameContent(const DrawnText &a, const DrawnText &b);
+    static void changedSpans(const DrawnText &from, const DrawnText &to, std::vector<std::pair<int, int>> *spans);
+    void drawText(Zone& zone, const DrawnText &text);
+    void syncOffscreen(Zone& zone, const rgb_matrix::FrameCanvas *shown);
+    void markIdle();
+    void updateMarkers();
+    [[nodiscard]] static int64_t scrolledQ16(const Zone& zone, const struct timespec &now);
+    static double q16PerFrame(Zone& zone, float frame_usec);
+    uint64_t nextStepFrame(uint64_t frame_count, float frame_usec);
+    static int64_t scrolledOnFrame(Zone& zone, uint64_t frame, float frame_usec);
+    void catchUpFrameClock();
+    [[nodiscard]] static int scrollPosition(const Zone& zone, int64_t scrolled_q16);
+    [[nodiscard]] static int scrollEnd(const Zone& zone);
+    [[nodiscard]] int64_t frameIntervalUsec() const;
+    [[nodiscard]] int64_t usecToNextStep(const struct timespec &now) const;
+    void waitForNextStep(const struct timespec &now, int64_t wait_usec);
+    [[nodiscard]] bool isMailboxEmpty() const;
     void updatePWMBits();
-    void dotCorners(const rgb_matrix::Color &, rgb_matrix::Canvas *aCanvas);
-    void setChangeDone() {setChangeDone(true);}
-    void setChangeDone(bool isChangeDone);
+    void updateBusyWaiting();
+    void dotCorners(const rgb_matrix::Color *dotColor);
+    void setChangeDone(Zone& zone) {setChangeDone(zone, true);}
+    void setChangeDone(Zone& zone, bool isChangeDone);
 };
 
 
@@ -5,13 +5,29 @@
 #include "MessageFormatter.h"
 
 #include <algorithm>
+#include <chrono>
+#include <cstring>   // strcmp
+#include <ctime>     // clock_gettime
 #include <string>
 #include <unistd.h>  // for io on linux, specifically for STDIN_FILENO
 
 static bool NO_VELOCITY_FOR_FIXED_TIMES = true;
 
-MessageFormatter::MessageFormatter(Displayer& aDisplayer, TextChangeOrder aOrderFormat)
-      : myDisplayer(aDisplayer), defaultOrderFormat(aOrderFormat),
+// the monotonic clock at the time the message was received, which may have been a while before it is handled
+static struct timespec monotonicReceiptTime(const Receiver::RawMessage& message) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  const int64_t age_usec = std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::microseconds>(
+                                                  std::chrono::system_clock::now() - message.timestamp).count());
+  const int64_t receipt_usec = static_cast<int64_t>(now.tv_sec) * 1000000 + now.tv_nsec / 1000 - age_usec;
+  struct timespec receipt;
+  receipt.tv_sec = static_cast<time_t>(receipt_usec / 1000000);
+  receipt.tv_nsec = static_cast<long>(receipt_usec % 1000000) * 1000;
+  return receipt;
+}
+
+MessageFormatter::MessageFormatter(Displayer& aDisplayer, TextChangeOrder aOrderFormat, int aRunningClockDigits)
+      : myDisplayer(aDisplayer), defaultOrderFormat(aOrderFormat), runningClockDigits(aRunningClockDigits),
         observedAlgeEventTypeChar(false), nextAlgeIntermediateLocationID(0) {
 
     // no further initialization needed
@@ -47,15 +63,24 @@ bool MessageFormatter::handleMessage(const Receiver::RawMessage& message) {
 }
 
 bool MessageFormatter::handleUPLCFormattedMessage(const Receiver::RawMessage& message) {
-  TextChangeOrder newOrder(defaultOrderFormat);  // copy the default order format
-  if (!newOrder.fromUPLCFormattedMessage(message.data)) {  // conversion failed
+  if (!convertUPLCFormattedMessage(message)) {  // conversion failed
     fprintf(stderr, "UPLC format conversion failed\n");
     return false;
   }
-  myDisplayer.startChangeOrder(newOrder);  // start the new order
+  myDisplayer.startChangeOrder(convertedUPLCOrder);  // start the new order
   return true;
 }
 
+// into convertedUPLCOrder; reuses the last conversion if it was the same message
+bool MessageFormatter::convertUPLCFormattedMessage(const Receiver::RawMessage& message) {
+  if (message.data != convertedUPLCMessage) {
+    convertedUPLCMessage = message.data;
+    convertedUPLCOrder = defaultOrderFormat;  // copy the default order format
+    isConvertedUPLCOrderOK = convertedUPLCOrder.fromUPLCFormattedMessage(message.data);
+  }
+  return isConvertedUPLCOrderOK;
+}
+
 bool MessageFormatter::handleAlgeMessage(const Receiver::RawMessage& message) {
   // message data includes eol, and may be all whitespace
   if (message.data.length() < 20) {
@@ -205,10 +230,13 @@ bool MessageFormatter::handleAlgeMessage(const Receiver::RawMessage& message) {
     return false;
   }
 
-  // assemble the message to display
+  // assemble the message to display.  A rank goes to its own zone if there is one, otherwise it follows the time.
+  const bool isRankZone = rankOrderFormat.has_value();
+  TextChangeOrder newOrder;
+  std::string rankText;
   if (isBlankMessage) {
-    TextChangeOrder newOrder = buildDefaultChangeOrder(" ");  // clear display
-    myDisplayer.startChangeOrder(newOrder);
+    newOrder = buildDefaultChangeOrder(" ");  // clear display
+    bibField.clear();
   }
   else if (isIntermediateOne || isIntermediateTwoPlus) {  
     // intermediate time
@@ -218,44 +246,52 @@ bool MessageFormatter::handleAlgeMessage(const Receiver::RawMessage& message) {
                              timeField
                              //+ (rankField.empty() ? "" : "[" + rankField + "]")
                              + " S"+std::to_string(nextAlgeIntermediateLocationID);
-    TextChangeOrder newOrder = buildDefaultChangeOrder(text.c_str());
+    newOrder = buildDefaultChangeOrder(text.c_str());
     if (NO_VELOCITY_FOR_FIXED_TIMES) newOrder.setVelocity(0);  // override velocity
-
-    myDisplayer.startChangeOrder(newOrder);
   }
   else if (isStillRunningTime) {
     const std::string text = "[ " + timeField + " ]";
-    myDisplayer.startChangeOrder(buildDefaultChangeOrder(text.c_str()));
-}
+    newOrder = buildDefaultChangeOrder(text.c_str());
+    int64_t runningMillis;
+    if (runningClockDigits > 0 && parseRunningTime(timeField, &runningMillis)) {
+      // tick on from the time of receipt, until the next message re-syncs or a finish time replaces it
+      newOrder.setVelocity(0);  // a ticking clock stays in place
+      newOrder.setRunningClock(2, timeField.length(), runningMillis, monotonicReceiptTime(message), runningClockDigits);
+    }
+  }
   else if (isTotalTimeOrUnknown) {
     // combine bib, time, and rank if provided
+    rankText = rankField.empty() ? "" : "(" + rankField + ")";
     const std::string text = //(bibField.empty() ? "" : bibField + "=") +
                              timeField
-                             + (rankField.empty() ? "" : "(" + rankField + ")");
-    TextChangeOrder newOrder = buildDefaultChangeOrder(text.c_str());
+                             + (isRankZone ? "" : rankText);
+    newOrder = buildDefaultChangeOrder(text.c_str());
     if (NO_VELOCITY_FOR_FIXED_TIMES) newOrder.setVelocity(0);  // override velocity
-
-    myDisplayer.startChangeOrder(newOrder);
   }
   else if (isRunTime) { // if run2 or later, RTPro sends total time, then run time, then total time again (with delays in between).
     // combine bib, time, and rank if provided
+    rankText = rankField.empty() ? "" : "(" + rankField + ")";
     const std::string text = //(bibField.empty() ? "" : bibField + "=") +
                              timeField
-                             + (rankField.empty() ? " Rn" : "(" + rankField + ")");
-    TextChangeOrder newOrder = buildDefaultChangeOrder(text.c_str());
+                             + (rankField.empty() ? " Rn" : (isRankZone ? "" : rankText));
+    newOrder = buildDefaultChangeOrder(text.c_str());
     if (NO_VELOCITY_FOR_FIXED_TIMES) newOrder.setVelocity(0);  // override velocity
-    myDisplayer.startChangeOrder(newOrder);
   }
   else {
     // unsure why didn't filter as total time, but do a similar display
     // combine bib, time, and rank if provided
+    rankText = rankField.empty() ? "" : "[" + rankField + "]";
     const std::string text = //(bibField.empty() ? "" : bibField + "=") +
                              timeField
-                             + (rankField.empty() ? "" : "[" + rankField + "]");
-    TextChangeOrder newOrder = buildDefaultChangeOrder(text.c_str());
+                             + (isRankZone ? "" : rankText);
+    newOrder = buildDefaultChangeOrder(text.c_str());
     if (NO_VELOCITY_FOR_FIXED_TIMES) newOrder.setVelocity(0);  // override velocity
-    myDisplayer.startChangeOrder(newOrder);
   }
+
+  // the time last, so that it is the order reported as displayed
+  postFieldOrder(bibOrderFormat, bibField);
+  postFieldOrder(rankOrderFormat, rankText);
+  myDisplayer.startChangeOrder(newOrder);
   return true;
 }
 
@@ -266,6 +302,67 @@ bool MessageFormatter::handleSimpleTextMessage(const Receiver::RawMessage& messa
   return true;
 }
 
+bool MessageFormatter::parseRunningTime(const std::string& timeField, int64_t* millis) {
+  int64_t seconds = 0;
+  int fieldCount = 0;
+  size_t pos = 0;
+  while (true) {
+    // digits of hours, minutes or seconds
+    size_t end = timeField.find_first_not_of("0123456789", pos);
+    if (end == std::string::npos) end = timeField.length();
+    if (end == pos || end - pos > 4) return false;  // no digits, or not a time
+    seconds = seconds * 60 + std::stoi(timeField.substr(pos, end - pos));
+    ++fieldCount;
+    pos = end;
+    if (pos == timeField.length() || timeField.at(pos) != ':') break;
+    if (fieldCount == 3) return false;
+    ++pos;
+  }
+
+  int64_t fractionMillis = 0;
+  if (pos < timeField.length()) {
+    if (timeField.at(pos) != '.') return false;
+    int scale = 100;
+    for (size_t i = pos + 1; i < timeField.length(); ++i) {
+      if (!isdigit(static_cast<unsigned char>(timeField.at(i)))) return false;
+      fractionMillis += (timeField.at(i) - '0') * scale;
+      scale /= 10;
+    }
+  }
+  *millis = seconds * 1000 + fractionMillis;
+  return true;
+}
+
+// a bib or rank in its own zone, if there is one. Unchanged fields are not posted again, so they don't hold up the
+// zone or redraw it at the rate of the times.
+void MessageFormatter::postFieldOrder(const std::optional<TextChangeOrder>& aOrderFormat, const std::string& text) {
+  if (!aOrderFormat.has_value()) return;
+  TextChangeOrder newOrder(*aOrderFormat);
+  newOrder.setText(text.empty() ? " " : text.c_str());   // clears the zone
+  const TextChangeOrder& postedOrder = myDisplayer.getChangeOrder(newOrder.getZone());
+  if (postedOrder.getZone() == newOrder.getZone() && strcmp(postedOrder.getText(), newOrder.getText()) == 0) return;
+  myDisplayer.startChangeOrder(newOrder);
+}
+
+bool MessageFormatter::isReadyFor(const Receiver::RawMessage& message) {
+  switch (message.protocol) {
+    case Receiver::Protocol::ALGE_DLINE:
+      return myDisplayer.isChangeOrderDone(defaultOrderFormat.getZone())
+             && (!bibOrderFormat.has_value() || myDisplayer.isChangeOrderDone(bibOrderFormat->getZone()))
+             && (!rankOrderFormat.has_value() || myDisplayer.isChangeOrderDone(rankOrderFormat->getZone()));
+
+    case Receiver::Protocol::SIMPLE_TEXT:
+      return myDisplayer.isChangeOrderDone(defaultOrderFormat.getZone());
+
+    case Receiver::Protocol::UPLC_FORMATTED_TEXT:
+      if (!convertUPLCFormattedMessage(message)) return true;  // rejected when handled
+      return myDisplayer.isChangeOrderDone(convertedUPLCOrder.getZone());
+
+    default:
+      return true;  // not displayed
+  }
+}
+
 TextChangeOrder MessageFormatter::buildDefaultChangeOrder(const char* text) const {
   TextChangeOrder newOrder(defaultOrderFormat);
   newOrder.setText(text);
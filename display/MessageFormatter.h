@@ -5,31 +5,51 @@
 #ifndef MESSAGEFORMATTER_H
 #define MESSAGEFORMATTER_H
 
+#include <optional>
+
 #include "Displayer.h"
 #include "Receiver.h"
 #include "TextChangeOrder.h"
 
 class MessageFormatter {
 public:
-  MessageFormatter(Displayer& aDisplayer, TextChangeOrder aOrderFormat);
+  // aRunningClockDigits 1 or 2: running times tick on locally, in tenths or hundredths, between messages. 0: shown as received
+  MessageFormatter(Displayer& aDisplayer, TextChangeOrder aOrderFormat, int aRunningClockDigits = 0);
 
   bool handleMessage(const Receiver::RawMessage& message);  // returns true if message forwarded for display (versus disregarded)
+  [[nodiscard]] bool isReadyFor(const Receiver::RawMessage& message);  // true if the zones the message goes to are done
+
+  // ALGE bibs and ranks in zones of their own, shown with these templates and updated only when they change.
+  // Without, bibs are not shown and ranks follow the time in the zone of the default order format.
+  void setBibOrderFormat(const TextChangeOrder& aOrderFormat) {bibOrderFormat = aOrderFormat;}
+  void setRankOrderFormat(const TextChangeOrder& aOrderFormat) {rankOrderFormat = aOrderFormat;}
 
   static std::string trimWhitespace(const std::string& str,
                                     const std::string& whitespace = " \t");
+  static bool parseRunningTime(const std::string& timeField, int64_t* millis);  // [[h:]m:]s[.fraction]
 
 private:
   Displayer& myDisplayer;
   TextChangeOrder defaultOrderFormat;
+  std::optional<TextChangeOrder> bibOrderFormat;
+  std::optional<TextChangeOrder> rankOrderFormat;
+  int runningClockDigits;
 
   bool observedAlgeEventTypeChar;  // state information: true if have most recently seen intermediate location specifications and hence we'll ignore messages without them as copies
   char lastBoardIDChar;  // state information: last board ID char seen in message (if any)
   int nextAlgeIntermediateLocationID;  // state information: next intermediate location to display if multiple messages received
 
+  // last UPLC formatted message converted, so that asking for its zone and handling it only convert it once
+  std::string convertedUPLCMessage;
+  TextChangeOrder convertedUPLCOrder;
+  bool isConvertedUPLCOrderOK = false;
+
   bool handleAlgeMessage(const Receiver::RawMessage& message);
   bool handleSimpleTextMessage(const Receiver::RawMessage& message);
   bool handleUPLCFormattedMessage(const Receiver::RawMessage& message);
+  bool convertUPLCFormattedMessage(const Receiver::RawMessage& message);
   TextChangeOrder buildDefaultChangeOrder(const char* text) const;
+  void postFieldOrder(const std::optional<TextChangeOrder>& aOrderFormat, const std::string& text);
 };
 
 
@@ -75,6 +75,11 @@ public:
           return !active_message_queue.empty();
      }
 
+     RawMessage peekPendingMessage() {    // copy of the message popPendingMessage() would return
+          rgb_matrix::MutexLock l(&mutex_msg_queue);
+          return active_message_queue.front();
+     }
+
      RawMessage popPendingMessage() {
           rgb_matrix::MutexLock l(&mutex_msg_queue);
           const RawMessage pendingMessage = active_message_queue.front();
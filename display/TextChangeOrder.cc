@@ -6,7 +6,15 @@
 #include "bdf-10x20-local.h"
 
 #include "graphics.h"
-#include <cmath>    // for fabs
+#include <unistd.h>  // isatty
+
+#include <algorithm>
+#include <cctype>   // isprint
+#include <charconv> // to_chars, from_chars
+#include <cmath>    // for fabs, nearbyint
+#include <cstdio>   // snprintf
+#include <cstdlib>  // strtof
+#include <cstring>  // memcpy, strnlen
 #include <utility>
 #include <stdexcept> // for std::exception
 
@@ -14,7 +22,7 @@ rgb_matrix::Font* SpacedFont::getDefaultFontPtr() {
     if (defaultFontPtr == nullptr) {
         // read built-in default font
         defaultFontPtr = new rgb_matrix::Font();
-        if (!defaultFontPtr->ReadFont(BDF_10X20_STRING)) {
+        if (!defaultFontPtr->ReadFont(BDF_10X20_STRING, getDisplayableCharacters())) {
             fprintf(stderr, "Couldn't read default built-in 10x20 font\n");
             // we proceed on with a default empty or partially constructed font, and no other error signalling
         }
@@ -27,65 +35,111 @@ int SpacedFont::getDefaultLetterSpacing() {
     return DEFAULT_SPACING;
 }
 
+const char* SpacedFont::getDisplayableCharacters() {
+    // Displayer replaces anything that is not printable ASCII before drawing,
+    // so there is no need to decode the thousands of other glyphs in a font.
+    static const char DISPLAYABLE[] =
+        " !\"#$%&'()*+,-./0123456789:;<=>?@"
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZ[\\]^_`"
+        "abcdefghijklmnopqrstuvwxyz{|}~";
+    return DISPLAYABLE;
+}
+
+int SpacedFont::getFontIndex(rgb_matrix::Font* aFontPtr) {
+    int count = numFonts.load(std::memory_order_relaxed);  // only this (the main) thread stores it
+    if (count == 0) {
+        fontTable[count++] = getDefaultFontPtr();
+        numFonts.store(count, std::memory_order_release);
+    }
+    if (aFontPtr == nullptr) return 0;
+    for (int i = 0; i < count; ++i) {
+        if (fontTable[i] == aFontPtr) return i;
+    }
+    if (count >= MAX_FONTS) {
+        fprintf(stderr, "More than %d fonts, showing with the default font\n", MAX_FONTS);
+        return 0;
+    }
+    fontTable[count] = aFontPtr;
+    numFonts.store(count + 1, std::memory_order_release);  // after the entry is filled
+    return count;
+}
+
 // static variable initialization
 rgb_matrix::Font* SpacedFont::defaultFontPtr = nullptr;
 std::vector<SpacedFont> SpacedFont::registeredSpacedFonts;
+rgb_matrix::Font* SpacedFont::fontTable[SpacedFont::MAX_FONTS] = {};
+std::atomic<int> SpacedFont::numFonts{0};
 int TextChangeOrder::xOriginDefault = 0;
 int TextChangeOrder::yOriginDefault = 0;
 std::vector<TextChangeOrder> TextChangeOrder::registeredTemplates;
 
 TextChangeOrder::TextChangeOrder()
     :
-    spacedFont(),
+    runningClockStart(),
+    runningClockMillis(0),
+    velocity(0.0f),
     foregroundColor(getDefaultForegroundColor()),
     backgroundColor(getDefaultBackgroundColor()),
-    velocity(0.0f),
+    x_origin(static_cast<int16_t>(xOriginDefault)),
+    y_origin(static_cast<int16_t>(yOriginDefault)),
+    fontIndex(0),
+    letterSpacing(static_cast<int8_t>(SpacedFont::getDefaultLetterSpacing())),
     velocityIsHorizontal(true),
     velocityScrollType(SINGLE_ONOFF),
-    x_origin(xOriginDefault),
-    y_origin(yOriginDefault),
+    zone(0),
+    runningClockDigits(0),
+    runningClockTimePos(0),
+    runningClockTimeLength(0),
+    textLength(0),
     text()
 {}
 
 
 TextChangeOrder::TextChangeOrder(const char* aText)
-    :
-    spacedFont(),
-    foregroundColor(getDefaultForegroundColor()),
-    backgroundColor(getDefaultBackgroundColor()),
-    velocity(0.0f),
-    velocityIsHorizontal(true),
-    velocityScrollType(SINGLE_ONOFF),
-    x_origin(xOriginDefault),
-    y_origin(yOriginDefault),
-    text(aText)
-    {}
+    : TextChangeOrder()
+{
+    setText(aText);
+}
 
-TextChangeOrder::TextChangeOrder(std::string  aString)
-    :
-    spacedFont(),
-    foregroundColor(getDefaultForegroundColor()),
-    backgroundColor(getDefaultBackgroundColor()),
-    velocity(0.0f),
-    velocityIsHorizontal(true),
-    velocityScrollType(SINGLE_ONOFF),
-    x_origin(xOriginDefault),
-    y_origin(yOriginDefault),
-    text(std::move(aString))
-{}
+TextChangeOrder::TextChangeOrder(const std::string& aString)
+    : TextChangeOrder()
+{
+    setString(aString);
+}
 
 TextChangeOrder::TextChangeOrder(SpacedFont aSpacedFont, const char* aText)
-    :
-    spacedFont(aSpacedFont),
-    foregroundColor(getDefaultForegroundColor()),
-    backgroundColor(getDefaultBackgroundColor()),
-    velocity(0.0f),
-    velocityIsHorizontal(true),
-    velocityScrollType(SINGLE_ONOFF),
-    x_origin(xOriginDefault),
-    y_origin(yOriginDefault),
-    text(aText)
-{}
+    : TextChangeOrder()
+{
+    setSpacedFont(aSpacedFont);
+    setText(aText);
+}
+
+TextChangeOrder& TextChangeOrder::setSpacedFont(const SpacedFont& aFont) {
+    fontIndex = static_cast<int8_t>(SpacedFont::getFontIndex(aFont.fontPtr));
+    letterSpacing = static_cast<int8_t>(aFont.letterSpacing);
+    return *this;
+}
+
+TextChangeOrder& TextChangeOrder::setText(const char* aText) {
+    textLength = static_cast<uint8_t>(strnlen(aText, MAX_TEXT_LENGTH));
+    memcpy(text, aText, textLength);
+    text[textLength] = '\0';
+    return *this;
+}
+
+TextChangeOrder& TextChangeOrder::replaceNonPrintableCharacters(const char aReplacement) {
+    for (unsigned i = 0; i < textLength; i++) {
+        // Check if the character is printable.
+        if (!isprint(static_cast<unsigned char>(text[i]))) {
+            if (isatty(STDIN_FILENO)) {
+                fprintf(stderr, "Replaced %02X with %c for display", static_cast<unsigned char>(text[i]), aReplacement);
+            }
+
+            text[i] = aReplacement;
+        }
+    }
+    return *this;
+}
 
 rgb_matrix::Color TextChangeOrder::getDefaultForegroundColor() {
     return {255, 0, 0};    // red
@@ -100,198 +154,383 @@ bool TextChangeOrder::isScrolling() const {
   return fabs((double)velocity) > eps;
 }
 
+TextChangeOrder& TextChangeOrder::setRunningClock(size_t aTimePos, size_t aTimeLength, int64_t aMillis,
+                                                  const struct timespec& aStart, int aDigits) {
+    runningClockDigits = static_cast<int8_t>((aDigits < 0) ? 0 : std::min(aDigits, 2));
+    runningClockTimePos = static_cast<uint8_t>(std::min<size_t>(aTimePos, textLength));
+    runningClockTimeLength = static_cast<uint8_t>(std::min<size_t>(aTimeLength, textLength - runningClockTimePos));
+    runningClockMillis = aMillis;
+    runningClockStart = aStart;
+    return *this;
+}
+
+int64_t TextChangeOrder::runningClockUsecAt(const struct timespec& now) const {
+    const int64_t since_start_usec = static_cast<int64_t>(now.tv_sec - runningClockStart.tv_sec) * 1000000
+                                     + (now.tv_nsec - runningClockStart.tv_nsec) / 1000;
+    return runningClockMillis * 1000 + std::max<int64_t>(since_start_usec, 0);
+}
+
+bool TextChangeOrder::updateRunningClock(const struct timespec& now) {
+    if (!isRunningClock()) return false;
+
+    char runningTime[32];
+    const size_t timeLength = std::min<size_t>(
+            formatRunningTime(runningClockUsecAt(now) / 1000, runningClockDigits, runningTime, sizeof(runningTime)),
+            MAX_TEXT_LENGTH - (textLength - runningClockTimeLength));  // no room: cut off, rather than the rest of the text
+    if (timeLength == runningClockTimeLength && memcmp(text + runningClockTimePos, runningTime, timeLength) == 0) return false;
+
+    // move what follows the time, if the time got longer or shorter
+    const size_t tailPos = runningClockTimePos + runningClockTimeLength;
+    memmove(text + runningClockTimePos + timeLength, text + tailPos, textLength - tailPos + 1);    // with the NUL
+    memcpy(text + runningClockTimePos, runningTime, timeLength);
+    textLength = static_cast<uint8_t>(textLength - runningClockTimeLength + timeLength);
+    runningClockTimeLength = static_cast<uint8_t>(timeLength);
+    return true;
+}
+
+int64_t TextChangeOrder::usecToNextRunningClockTick(const struct timespec& now) const {
+    const int64_t tick_usec = (runningClockDigits == 1) ? 100000 : 10000;
+    return tick_usec - runningClockUsecAt(now) % tick_usec;
+}
+
+// same layout as the times received, after MessageFormatter removed leading zeros
+int TextChangeOrder::formatRunningTime(int64_t millis, int digits, char* buffer, size_t size) {
+    const int64_t fraction_divider = (digits == 1) ? 100 : 10;
+    const int64_t seconds = millis / 1000;
+    const int fraction = static_cast<int>((millis % 1000) / fraction_divider);
+
+    if (seconds >= 3600) {
+      return snprintf(buffer, size, "%d:%02d:%02d.%0*d", static_cast<int>(seconds / 3600),
+                      static_cast<int>(seconds / 60 % 60), static_cast<int>(seconds % 60), digits, fraction);
+    }
+    return snprintf(buffer, size, "%d:%02d.%0*d", static_cast<int>(seconds / 60),
+                    static_cast<int>(seconds % 60), digits, fraction);
+}
+
 bool TextChangeOrder::orderDoneHasEmptyDisplay() const {
-    return text.empty()
+    return textLength == 0
             || (isScrolling() && velocityScrollType == SINGLE_ONOFF);  // scrolling (velocity not zero), but this scroll type ends with empty display
 }
 
-std::string TextChangeOrder::toUPLCFormattedMessage() const {
-    std::string result = UPLC_FORMATTED_PREFIX;
+// The UPLC format is encoded and decoded in one pass, without allocating: into a caller's buffer, and in place.
+
+static constexpr char HEX_DIGITS[] = "0123456789abcdef";
+
+// value of each character as a hex digit, -1 if it is none
+struct HexValues {
+    int8_t of[256];
+    constexpr HexValues() : of() {
+        for (int c = 0; c < 256; ++c) of[c] = -1;
+        for (int d = 0; d < 10; ++d) of['0' + d] = static_cast<int8_t>(d);
+        for (int d = 0; d < 6; ++d) {
+            of['a' + d] = static_cast<int8_t>(10 + d);
+            of['A' + d] = static_cast<int8_t>(10 + d);
+        }
+    }
+};
+static constexpr HexValues HEX_VALUES;
+
+static char* writeHexColor(char* out, char code, const rgb_matrix::Color& color) {
+    *out++ = code;
+    for (const uint8_t component : {color.r, color.g, color.b}) {
+        *out++ = HEX_DIGITS[component >> 4];
+        *out++ = HEX_DIGITS[component & 0x0F];
+    }
+    return out;
+}
+
+// as printf("%+03d"): sign, at least 2 digits
+static char* writeOrigin(char* out, char code, int origin) {
+    *out++ = code;
+    *out++ = (origin < 0) ? '-' : '+';
+    const unsigned magnitude = (origin < 0) ? 0u - static_cast<unsigned>(origin) : static_cast<unsigned>(origin);
+    if (magnitude < 10) *out++ = '0';
+    return std::to_chars(out, out + 10, magnitude).ptr;
+}
+
+// as printf("%+05.1f"): sign, at least 2 integer digits, 1 decimal. Speeds beyond the 5 integer digits the
+// decoder reads are not a speed anyone sends; they are clamped, and sent as 0 if not a number at all.
+static constexpr double MAX_VELOCITY_TENTHS = 999999;
+static char* writeVelocity(char* out, float velocity) {
+    *out++ = 'V';
+    // the product is exact, and rounds to even like printf does
+    double tenths = std::nearbyint(static_cast<double>(velocity) * 10);
+    if (std::isnan(tenths)) tenths = 0;
+    tenths = std::clamp(tenths, -MAX_VELOCITY_TENTHS, MAX_VELOCITY_TENTHS);
+    *out++ = std::signbit(velocity) ? '-' : '+';
+    const auto magnitude = static_cast<uint32_t>(std::fabs(tenths));
+    if (magnitude < 100) *out++ = '0';
+    out = std::to_chars(out, out + 20, magnitude / 10).ptr;
+    *out++ = '.';
+    *out++ = static_cast<char>('0' + magnitude % 10);
+    return out;
+}
+
+size_t TextChangeOrder::toUPLCFormattedMessage(char* buffer, size_t size) const {
+    if (size < UPLC_FORMATTED_MAX_LENGTH) return 0;
+    char* out = buffer;
+    memcpy(out, UPLC_FORMATTED_PREFIX.data(), UPLC_FORMATTED_PREFIX.length());
+    out += UPLC_FORMATTED_PREFIX.length();
 
     // look for registered font key
     // support max of 10 fonts, 0-9
+    const SpacedFont spacedFont = getSpacedFont();
     for (int i = 0; i < 10 && i < SpacedFont::getNumRegisteredFonts(); ++i) {
         if (spacedFont.equals(SpacedFont::getRegisteredSpacedFont(i))) {
-            result += "!" + std::to_string(i);  // font prefix and index
+            *out++ = '!';   // font prefix and index
+            *out++ = static_cast<char>('0' + i);
             break;
         }
     }
 
     // add foreground and background colors
-    {
-        constexpr int MAX_COLOR_CONVERSION_LENGTH = 20;
-        char formattedColorBuffer[MAX_COLOR_CONVERSION_LENGTH];
-        sprintf(formattedColorBuffer, "F%02x%02x%02xB%02x%02x%02x", 
-                foregroundColor.r, foregroundColor.g, foregroundColor.b,
-                backgroundColor.r, backgroundColor.g, backgroundColor.b
-            );
-        result += formattedColorBuffer;
-    }
+    out = writeHexColor(out, 'F', foregroundColor);
+    out = writeHexColor(out, 'B', backgroundColor);
 
     // add velocity
-    {
-        constexpr int MAX_VELOCITY_CONVERSION_LENGTH = 20;
-        char formattedVelocityBuffer[MAX_VELOCITY_CONVERSION_LENGTH];
-        sprintf(formattedVelocityBuffer, "V%+05.1f", velocity);
-        result += formattedVelocityBuffer;
-    }
+    out = writeVelocity(out, velocity);
 
     // add scrolling direction and type
-    result += "D" + std::to_string((int)velocityIsHorizontal);
-    result += "S" + std::to_string((int)velocityScrollType);
+    *out++ = 'D';
+    *out++ = velocityIsHorizontal ? '1' : '0';
+    *out++ = 'S';
+    out = std::to_chars(out, out + 3, static_cast<unsigned>(velocityScrollType)).ptr;
 
     // add x and y origin
-    {
-        constexpr int MAX_ORIGIN_CONVERSION_LENGTH = 20;
-        char formattedOriginBuffer[MAX_ORIGIN_CONVERSION_LENGTH];
-        sprintf(formattedOriginBuffer, "X%+03dY%+03d", x_origin, y_origin);
-        result += formattedOriginBuffer;
+    out = writeOrigin(out, 'X', x_origin);
+    out = writeOrigin(out, 'Y', y_origin);
+
+    // add zone, only if not the default. There are zones 0-9; others are shown in zone 0.
+    if (zone > 0 && zone <= 9) {
+        *out++ = 'Z';
+        *out++ = static_cast<char>('0' + zone);
     }
 
     // add text, truncated if necessary
-    constexpr int MAX_TEXT_LENGTH = 55;  // max length of text to be sent
-    result += "=" + text.substr(0, MAX_TEXT_LENGTH);  // add text, truncated to max length
+    constexpr size_t MAX_SENT_TEXT_LENGTH = 55;  // max length of text to be sent
+    const size_t sentLength = std::min<size_t>(textLength, MAX_SENT_TEXT_LENGTH);
+    *out++ = '=';
+    memcpy(out, text, sentLength);
+    out += sentLength;
+
+    memcpy(out, UPLC_FORMATTED_SUFFIX.data(), UPLC_FORMATTED_SUFFIX.length());
+    out += UPLC_FORMATTED_SUFFIX.length();
+    *out = '\0';
+    return out - buffer;
+}
+
+std::string TextChangeOrder::toUPLCFormattedMessage() const {
+    char buffer[UPLC_FORMATTED_MAX_LENGTH];
+    return std::string(buffer, toUPLCFormattedMessage(buffer, sizeof(buffer)));
+}
+
+// Fields are read exactly as toUPLCFormattedMessage() writes them: no blanks, no "0x" prefixes, no signs where
+// there are none, and nothing left over. Each returns the end of the field, nullptr if it is not one.
+
+// "%02x" of a color component
+static const char* parseHexField(const char* p, const char* end, uint8_t* value) {
+    if (end - p < 2) return nullptr;
+    const int high = HEX_VALUES.of[static_cast<uint8_t>(p[0])];
+    const int low = HEX_VALUES.of[static_cast<uint8_t>(p[1])];
+    if (high < 0 || low < 0) return nullptr;
+    *value = static_cast<uint8_t>(high * 16 + low);
+    return p + 2;
+}
+
+static const char* skipDigits(const char* p, const char* end) {
+    while (p < end && isdigit(static_cast<unsigned char>(*p))) ++p;
+    return p;
+}
+
+// "%+03d" of an origin, which fits an int16_t
+static const char* parseOriginField(const char* p, const char* end, int* value) {
+    if (p == end || (*p != '+' && *p != '-')) return nullptr;
+    const bool isNegative = (*p++ == '-');
+    const char* digitsEnd = skipDigits(p, end);
+    if (digitsEnd - p < 2) return nullptr;
+    int magnitude = 0;
+    if (std::from_chars(p, digitsEnd, magnitude).ec != std::errc() || magnitude > 32768
+        || (magnitude == 32768 && !isNegative)) return nullptr;
+    *value = isNegative ? -magnitude : magnitude;
+    return digitsEnd;
+}
 
-    result += UPLC_FORMATTED_SUFFIX;
-    return result;
+// "%+05.1f" of a velocity, up to the 5 integer digits toUPLCFormattedMessage() writes
+static const char* parseVelocityField(const char* p, const char* end, float* value) {
+    const char* const begin = p;
+    if (p == end || (*p != '+' && *p != '-')) return nullptr;
+    const char* digitsEnd = skipDigits(++p, end);
+    if (digitsEnd - p < 2 || digitsEnd - p > 5) return nullptr;
+    if (end - digitsEnd < 2 || digitsEnd[0] != '.' || !isdigit(static_cast<unsigned char>(digitsEnd[1]))) return nullptr;
+    const char* const fieldEnd = digitsEnd + 2;
+
+    // strtof() rounds like the decimal would be; the field has no more than 9 characters
+    char field[10];
+    memcpy(field, begin, fieldEnd - begin);
+    field[fieldEnd - begin] = '\0';
+    *value = strtof(field, nullptr);
+    return fieldEnd;
+}
+
+// one digit from '0' to maxDigit
+static const char* parseDigitField(const char* p, const char* end, char maxDigit, int* value) {
+    if (p == end || *p < '0' || *p > maxDigit) return nullptr;
+    *value = *p - '0';
+    return p + 1;
 }
 
-bool TextChangeOrder::fromUPLCFormattedMessage(std::string messageString) {
-    if (messageString.substr(0, UPLC_FORMATTED_PREFIX.length()) != UPLC_FORMATTED_PREFIX
-        || messageString.substr(messageString.length()-UPLC_FORMATTED_SUFFIX.length(), UPLC_FORMATTED_SUFFIX.length()) != UPLC_FORMATTED_SUFFIX) {
+bool TextChangeOrder::fromUPLCFormattedMessage(const std::string& messageString) {
+    return fromUPLCFormattedMessage(messageString.data(), messageString.length());
+}
+
+bool TextChangeOrder::fromUPLCFormattedMessage(const char* message, size_t length) {
+    const int printLength = static_cast<int>(length);
+    const size_t prefixLength = UPLC_FORMATTED_PREFIX.length();
+    const size_t suffixLength = UPLC_FORMATTED_SUFFIX.length();
+    if (length < prefixLength + suffixLength
+        || memcmp(message, UPLC_FORMATTED_PREFIX.data(), prefixLength) != 0
+        || memcmp(message + length - suffixLength, UPLC_FORMATTED_SUFFIX.data(), suffixLength) != 0) {
         // no action, format not recognized
-        fprintf(stderr, "At conversion, UPLC formatted prefix %s or suffix newline not found:%s\n",
-                UPLC_FORMATTED_PREFIX.c_str(), messageString.c_str());   
+        fprintf(stderr, "At conversion, UPLC formatted prefix %s or suffix newline not found:%.*s\n",
+                UPLC_FORMATTED_PREFIX.c_str(), printLength, message);
         return false;  // not a UPLC formatted message
     }
 
-    int charIndex = UPLC_FORMATTED_PREFIX.length();
-    while ((int)messageString.length() > charIndex) {
-        const char c = toupper(messageString.at(charIndex));
+    const char* const messageEnd = message + length;
+    // for error messages: the usual width of the field at "begin", cut short by the end of the message
+    auto fieldLength = [messageEnd](const char* begin, size_t width) {
+        return static_cast<int>(std::min<size_t>(messageEnd - begin, width));
+    };
+
+    const char* p = message + prefixLength;
+    while (p < messageEnd) {
+        const char c = static_cast<char>(toupper(static_cast<unsigned char>(*p)));
         switch (c) {
             case '!': {  // font prefix
-                charIndex++;
-
-                try {
-                    // support max of 10 fonts, 0-9
-                    const int fontIndex = std::stoi(messageString.substr(charIndex, 1));
-                    if (fontIndex >= 0 && fontIndex < SpacedFont::getNumRegisteredFonts()) {
-                        spacedFont = SpacedFont::getRegisteredSpacedFont(fontIndex);
-                    }
-                    else {
-                        fprintf(stderr, "At conversion, UPLC formatted font index %d not found:%s\n",
-                                fontIndex, messageString.c_str());   
-                    }
-                }
-                catch (const std::exception& e) {
-                    // stoi failed.  keep current font   
-                    return false;
+                p++;
+
+                // support max of 10 fonts, 0-9
+                if (p == messageEnd || !isdigit(static_cast<unsigned char>(*p))) {
+                    return false;   // keep current font
                 }
-                charIndex++;  // skip over the font index
-                break;
-            }
-            case 'F': {  // foreground color
-                charIndex++;
-                int fr,fg,fb;
-                if (sscanf(messageString.substr(charIndex, 2).c_str(), "%x", &fr) != 1
-                    || sscanf(messageString.substr(charIndex+2, 2).c_str(), "%x", &fg) != 1
-                    || sscanf(messageString.substr(charIndex+4, 2).c_str(), "%x", &fb) != 1) {
-                    foregroundColor = getDefaultForegroundColor();  // reset to default if error
-                    fprintf(stderr, "At conversion, UPLC formatted foreground color %s not found:%s\n",
-                            messageString.substr(charIndex, 6).c_str(), messageString.c_str());
-                    return false;
+                const int fontIndex = *p - '0';
+                if (fontIndex < SpacedFont::getNumRegisteredFonts()) {
+                    setSpacedFont(SpacedFont::getRegisteredSpacedFont(fontIndex));
                 }
                 else {
-                    foregroundColor = rgb_matrix::Color((uint8_t)fr,(uint8_t)fg,(uint8_t)fb);  // set color
+                    fprintf(stderr, "At conversion, UPLC formatted font index %d not found:%.*s\n",
+                            fontIndex, printLength, message);
                 }
-                charIndex += 6;  // skip over the color codes
+                p++;  // skip over the font index
                 break;
             }
+            case 'F':    // foreground color
             case 'B': {  // background color
-                charIndex++;
-                int br,bg,bb;
-                if (sscanf(messageString.substr(charIndex, 2).c_str(), "%x", &br) != 1
-                    || sscanf(messageString.substr(charIndex+2, 2).c_str(), "%x", &bg) != 1
-                    || sscanf(messageString.substr(charIndex+4, 2).c_str(), "%x", &bb) != 1) {
-                    backgroundColor = getDefaultBackgroundColor();  // reset to default if error
-                    fprintf(stderr, "At conversion, UPLC formatted background color %s not found:%s\n",
-                            messageString.substr(charIndex, 6).c_str(), messageString.c_str());
+                p++;
+                rgb_matrix::Color& color = (c == 'F') ? foregroundColor : backgroundColor;
+                uint8_t r = 0, g = 0, b = 0;
+                const char* colorEnd = parseHexField(p, messageEnd, &r);
+                if (colorEnd) colorEnd = parseHexField(colorEnd, messageEnd, &g);
+                if (colorEnd) colorEnd = parseHexField(colorEnd, messageEnd, &b);
+                if (!colorEnd) {
+                    color = (c == 'F') ? getDefaultForegroundColor() : getDefaultBackgroundColor();  // reset to default if error
+                    fprintf(stderr, "At conversion, UPLC formatted %s color %.*s not found:%.*s\n",
+                            (c == 'F') ? "foreground" : "background", fieldLength(p, 6), p, printLength, message);
                     return false;
                 }
-                else {
-                    backgroundColor = rgb_matrix::Color((uint8_t)br,(uint8_t)bg,(uint8_t)bb);  // set color
-                }
-                charIndex += 6;  // skip over the color codes
-                break; 
+                color = rgb_matrix::Color(r, g, b);  // set color
+                p = colorEnd;  // skip over the color codes
+                break;
             }
             case 'V': {  // velocity
-                charIndex++;
-                if (sscanf(messageString.substr(charIndex, 5).c_str(), "%f", &velocity) != 1) {
+                p++;
+                const char* velocityEnd = parseVelocityField(p, messageEnd, &velocity);
+                if (!velocityEnd) {
                     velocity = 0.0f;  // reset to default if error
-                    fprintf(stderr, "At conversion, UPLC formatted velocity %s not found:%s\n",
-                            messageString.substr(charIndex, 5).c_str(), messageString.c_str());
+                    fprintf(stderr, "At conversion, UPLC formatted velocity %.*s not found:%.*s\n",
+                            fieldLength(p, 5), p, printLength, message);
                     return false;
                 }
-                charIndex += 5;  // skip over the velocity data
-                break;
-            }
-            case 'X': {  // x origin, 2 digits with leading sign character
-                charIndex++;
-                if (sscanf(messageString.substr(charIndex, 3).c_str(), "%d", &x_origin) != 1) {
-                    x_origin = getXOriginDefault();  // reset to default if error
-                    fprintf(stderr, "At conversion, UPLC formatted x origin %s not accepted:%s\n",
-                            messageString.substr(charIndex, 3).c_str(), messageString.c_str());
-                    return false;
-                }
-                charIndex += 3;  // skip over the origin data
+                p = velocityEnd;  // skip over the velocity data
                 break;
             }
+            case 'X':    // x origin, 2 digits with leading sign character
             case 'Y': {  // y origin, 2 digits with leading sign character
-                charIndex++;
-                if (sscanf(messageString.substr(charIndex, 3).c_str(), "%d", &y_origin) != 1) {
-                    y_origin = getYOriginDefault();  // reset to default if error
-                    fprintf(stderr, "At conversion, UPLC formatted y origin %s not accepted:%s\n",
-                            messageString.substr(charIndex, 3).c_str(), messageString.c_str());
+                p++;
+                int origin;
+                const char* originEnd = parseOriginField(p, messageEnd, &origin);
+                const bool isParsed = (originEnd != nullptr);
+                if (!isParsed) {
+                    origin = (c == 'X') ? getXOriginDefault() : getYOriginDefault();  // reset to default if error
+                }
+                if (c == 'X') {
+                    setXOrigin(origin);
+                }
+                else {
+                    setYOrigin(origin);
+                }
+                if (!isParsed) {
+                    fprintf(stderr, "At conversion, UPLC formatted %c origin %.*s not accepted:%.*s\n",
+                            tolower(c), fieldLength(p, 3), p, printLength, message);
                     return false;
                 }
-                charIndex += 3;  // skip over the origin data
+                p = originEnd;  // skip over the origin data
                 break;
             }
             case 'D': {  // horizontal scrolling
-                charIndex++;
-                if (sscanf(messageString.substr(charIndex, 1).c_str(), "%d", (int*)&velocityIsHorizontal) != 1) {
+                p++;
+                int isHorizontal;
+                if (!parseDigitField(p, messageEnd, '1', &isHorizontal)) {
                     velocityIsHorizontal = true;  // reset to default if error
-                    fprintf(stderr, "At conversion, UPLC formatted horizontal scroll %s not found:%s\n",
-                            messageString.substr(charIndex, 1).c_str(), messageString.c_str());
+                    fprintf(stderr, "At conversion, UPLC formatted horizontal scroll %.*s not found:%.*s\n",
+                            fieldLength(p, 1), p, printLength, message);
                     return false;
                 }
-                charIndex++;
+                velocityIsHorizontal = (isHorizontal != 0);
+                p++;
                 break;
             }
             case 'S': {  // scroll type
-                charIndex++;
-                if (sscanf(messageString.substr(charIndex, 1).c_str(), "%d", (int*)&velocityScrollType) != 1) {
+                p++;
+                int scrollType;
+                if (!parseDigitField(p, messageEnd, '0' + SINGLE_ONOFF, &scrollType)) {
                     velocityScrollType = SINGLE_ONOFF;  // reset to default if error
-                    fprintf(stderr, "At conversion, UPLC formatted scroll type %s not found:%s\n",
-                            messageString.substr(charIndex, 1).c_str(), messageString.c_str());
+                    fprintf(stderr, "At conversion, UPLC formatted scroll type %.*s not found:%.*s\n",
+                            fieldLength(p, 1), p, printLength, message);
                     return false;
                 }
-                charIndex++;
+                velocityScrollType = static_cast<ScrollType>(scrollType);
+                p++;
+                break;
+            }
+            case 'Z': {  // zone, 1 digit
+                p++;
+                int zoneNumber;
+                if (!parseDigitField(p, messageEnd, '9', &zoneNumber)) {
+                    zone = 0;  // reset to default if error
+                    fprintf(stderr, "At conversion, UPLC formatted zone %.*s not found:%.*s\n",
+                            fieldLength(p, 1), p, printLength, message);
+                    return false;
+                }
+                setZone(zoneNumber);
+                p++;
                 break;
             }
             case '=': {  // text string
-                charIndex++;
-                text = messageString.substr(charIndex, messageString.length()-charIndex-UPLC_FORMATTED_SUFFIX.length());   // remainder of string, except for suffix, is the message text
-                charIndex = messageString.length();
+                p++;
+                // remainder of string, except for suffix, is the message text
+                textLength = static_cast<uint8_t>(strnlen(p, std::min<size_t>(messageEnd - suffixLength - p, MAX_TEXT_LENGTH)));
+                memcpy(text, p, textLength);
+                text[textLength] = '\0';
                 return true;   // done processing all characters
             }
             default:
-                fprintf(stderr, "At conversion, UPLC formatted with unknown format code %c at char index %d: %s\n",
-                        c, charIndex, messageString.c_str());   
-                //charIndex++;  // skip over the unknown format code, keep searching (may see multiple errors)
+                fprintf(stderr, "At conversion, UPLC formatted with unknown format code %c at char index %d: %.*s\n",
+                        c, static_cast<int>(p - message), printLength, message);
+                //p++;  // skip over the unknown format code, keep searching (may see multiple errors)
                 return false;
         }
 
     }
     return true;  // done processing all characters
-}
\ No newline at end of file
+}
@@ -5,7 +5,12 @@
 #ifndef TEXTCHANGEORDER_H
 #define TEXTCHANGEORDER_H
 
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>      // timespec
 #include <string>
+#include <type_traits>
 #include <vector>
 #include "graphics.h"
 
@@ -23,6 +28,7 @@ struct SpacedFont {
 
     static rgb_matrix::Font* getDefaultFontPtr();
     static int getDefaultLetterSpacing();
+    static const char* getDisplayableCharacters();  // glyphs worth loading from built-in fonts
     static SpacedFont getDefaultSpacedFont() {return SpacedFont();}   // default font with default spacing
     
     static inline SpacedFont getRegisteredSpacedFont(int registeredIndex) {
@@ -32,6 +38,7 @@ struct SpacedFont {
         return registeredSpacedFonts[registeredIndex];
     }
     static inline int registerFont(SpacedFont aSpacedFont) {    // returns new index, for reference
+        getFontIndex(aSpacedFont.fontPtr);  // so that orders with this font never add to the font table
         registeredSpacedFonts.push_back(aSpacedFont);
         return registeredSpacedFonts.size() - 1;   // index of new font
     }
@@ -39,17 +46,34 @@ struct SpacedFont {
         return registeredSpacedFonts.size();
     }    
 
+    // Font table, so that a change order refers to its font by a small index instead of a pointer.
+    // Fonts are added from the main thread only; entries never move. The count is published after its entry is
+    // filled, so the Displayer's thread never sees an index whose entry is not there yet.
+    static constexpr int MAX_FONTS = 16;
+    static int getFontIndex(rgb_matrix::Font* aFontPtr);   // adds the font if new; 0 (default font) if the table is full
+    static rgb_matrix::Font* getFontAt(int fontIndex) {
+        return (fontIndex > 0 && fontIndex < numFonts.load(std::memory_order_acquire)) ? fontTable[fontIndex]
+                                                                                       : getDefaultFontPtr();
+    }
+
     private:
     static rgb_matrix::Font* defaultFontPtr;
     static std::vector<SpacedFont> registeredSpacedFonts;
+    static rgb_matrix::Font* fontTable[MAX_FONTS];  // entry 0 is the default font
+    static std::atomic<int> numFonts;
 };
 
 class TextChangeOrder {
     public:
     inline static const std::string UPLC_FORMATTED_PREFIX = "~+/";   // start of UPLC formatted text protocol
     inline static const std::string UPLC_FORMATTED_SUFFIX = "\x0D";   // end of line for UPLC formatted text protocol
+    static constexpr size_t UPLC_FORMATTED_MAX_LENGTH = 160;  // buffer that always holds a UPLC formatted order
 
-    enum ScrollType {   // when velocity is not zero...
+    // longest text of an order: no protocol message is longer, see Receiver::PROTOCOL_MESSAGE_MAX_LENGTH.
+    // Longer texts are cut off.
+    static constexpr size_t MAX_TEXT_LENGTH = 96;
+
+    enum ScrollType : uint8_t {   // when velocity is not zero...
 
             CONTINUOUS,    // 0: scroll forever. start off one side, end off the other side, restart
             SINGLE_ON,     // 1: start off one side, end when at origin position on screen
@@ -58,12 +82,12 @@ class TextChangeOrder {
 
     TextChangeOrder();  // empty text
     explicit TextChangeOrder(const char* aText);   // default font, spacing,  colors, speed
-    explicit TextChangeOrder(std::string  aString);   // default font, spacing, colors, speed
+    explicit TextChangeOrder(const std::string& aString);   // default font, spacing, colors, speed
     TextChangeOrder(SpacedFont aSpacedFont, const char* aText);   // default colors
     TextChangeOrder(const TextChangeOrder& aTextChangeOrder) = default;
 
-    TextChangeOrder& setSpacedFont(const SpacedFont& aFont) {spacedFont = aFont; return *this;}
-    [[nodiscard]] SpacedFont getSpacedFont() const {return spacedFont;}
+    TextChangeOrder& setSpacedFont(const SpacedFont& aFont);
+    [[nodiscard]] SpacedFont getSpacedFont() const {return SpacedFont(SpacedFont::getFontAt(fontIndex), letterSpacing);}
 
     TextChangeOrder& setForegroundColor(const rgb_matrix::Color aColor) {foregroundColor = aColor; return *this;}
     [[nodiscard]] rgb_matrix::Color getForegroundColor() const {return foregroundColor;}
@@ -71,10 +95,11 @@ class TextChangeOrder {
     TextChangeOrder& setBackgroundColor(const rgb_matrix::Color aColor) {backgroundColor = aColor; return *this;}
     [[nodiscard]] rgb_matrix::Color getBackgroundColor() const {return backgroundColor;}
 
-    TextChangeOrder& setText(const char* aText) {text.assign(aText); return *this;}
-    TextChangeOrder& setString(const std::string& aString) {text = aString; return *this;}
-    [[nodiscard]] const char* getText() const { return text.c_str(); }
-    std::string getString() const {return text;}
+    TextChangeOrder& setText(const char* aText);   // cut off after MAX_TEXT_LENGTH characters
+    TextChangeOrder& setString(const std::string& aString) {return setText(aString.c_str());}
+    [[nodiscard]] const char* getText() const { return text; }
+    std::string getString() const {return std::string(text, textLength);}
+    TextChangeOrder& replaceNonPrintableCharacters(char aReplacement);   // so that every character has a glyph
     [[nodiscard]] bool orderDoneHasEmptyDisplay() const;    // is display empty when the order is marked Done
 
     // negative horizontal is to the left, negative vertical is up
@@ -89,14 +114,33 @@ class TextChangeOrder {
     TextChangeOrder&  setVelocityScrollType(ScrollType aVelocityScrollType) {velocityScrollType = aVelocityScrollType; return *this;}
     [[nodiscard]] ScrollType getVelocityScrollType() const { return velocityScrollType; }
 
-    TextChangeOrder& setXOrigin(const int aX_origin) {x_origin = aX_origin; return *this;}
+    TextChangeOrder& setXOrigin(const int aX_origin) {x_origin = static_cast<int16_t>(aX_origin); return *this;}
     [[nodiscard]] int getXOrigin() const {return x_origin;}
 
-    TextChangeOrder& setYOrigin(const int aY_origin) {y_origin = aY_origin; return *this;}
+    TextChangeOrder& setYOrigin(const int aY_origin) {y_origin = static_cast<int16_t>(aY_origin); return *this;}
     [[nodiscard]] int getYOrigin() const {return y_origin;}
 
+    // zone of the panel to show in, see Displayer::setZones(); origins are relative to it
+    TextChangeOrder& setZone(const int aZone) {zone = static_cast<int8_t>(aZone); return *this;}
+    [[nodiscard]] int getZone() const {return zone;}
+
+    // running clock: the part of the text at aTimePos, aTimeLength long, is a running time that counts on from aMillis
+    // at aStart (CLOCK_MONOTONIC), shown with aDigits (1 or 2) fractional digits. aDigits 0 turns it off.
+    TextChangeOrder& setRunningClock(size_t aTimePos, size_t aTimeLength, int64_t aMillis,
+                                     const struct timespec& aStart, int aDigits);
+    [[nodiscard]] bool isRunningClock() const {return runningClockDigits > 0;}
+    bool updateRunningClock(const struct timespec& now);    // set the running time at "now" in the text; true if it changed
+    [[nodiscard]] int64_t usecToNextRunningClockTick(const struct timespec& now) const;  // until the shown time changes
+    // h:mm:ss.t or m:ss.t, with 1 or 2 digits; returns the length, as snprintf()
+    static int formatRunningTime(int64_t millis, int digits, char* buffer, size_t size);
+
     std::string toUPLCFormattedMessage() const;  // returns a string with the UPLC protocol format to set this order
-    bool fromUPLCFormattedMessage(std::string messageString);  // overwrite this object with attributes from the UPLC protocol format string
+    // writes the UPLC protocol format into buffer, NUL terminated; returns the length, 0 if size < UPLC_FORMATTED_MAX_LENGTH
+    size_t toUPLCFormattedMessage(char* buffer, size_t size) const;
+    // overwrite this object with attributes from the UPLC protocol format string; false at the first field that is
+    // not written as toUPLCFormattedMessage() writes it
+    bool fromUPLCFormattedMessage(const std::string& messageString);
+    bool fromUPLCFormattedMessage(const char* message, size_t length);  // same, parsed in place
 
     static rgb_matrix::Color getDefaultForegroundColor();
     static rgb_matrix::Color getDefaultBackgroundColor();
@@ -122,17 +166,29 @@ class TextChangeOrder {
     }    
 
 
+    // Packed and trivially copyable: copies never allocate, and orders can be passed around as plain bytes.
     private:
-    SpacedFont spacedFont;
+    struct timespec runningClockStart;
+    int64_t runningClockMillis;         // running time at runningClockStart
+    float velocity;                     // default is 0.0=no motion.  1.0=one default font character width (of W) per second
     rgb_matrix::Color foregroundColor;  // default is an extreme color (255 for some subset of R,G,B)
     rgb_matrix::Color backgroundColor;  // default black
-    float velocity;                     // default is 0.0=no motion.  1.0=approx one character width per second
+    int16_t x_origin;                   // default is 0 but can be changed
+    int16_t y_origin;                   // default is 0 but can be changed 
+    int8_t fontIndex;                   // in the font table, see SpacedFont::getFontAt()
+    int8_t letterSpacing;
     bool velocityIsHorizontal;          // default is true for horizontal scrolling. Set false for vertical
     ScrollType velocityScrollType;      // default is 2 to scroll across and off screen, once
-    int x_origin;                       // default is 0 but can be changed
-    int y_origin;                       // default is 0 but can be changed 
+    int8_t zone;                        // default is 0, the whole panel unless zones are set up
+
+    int8_t runningClockDigits;          // default is 0, not a running clock
+    uint8_t runningClockTimePos;        // where the running time is in the text
+    uint8_t runningClockTimeLength;
 
-    std::string text;
+    uint8_t textLength;
+    char text[MAX_TEXT_LENGTH + 1];     // NUL terminated
+
+    [[nodiscard]] int64_t runningClockUsecAt(const struct timespec& now) const;
 
     static int xOriginDefault;
     static int yOriginDefault;
@@ -140,6 +196,8 @@ class TextChangeOrder {
 
 };
 
+static_assert(std::is_trivially_copyable<TextChangeOrder>::value, "change orders are copied as plain bytes");
+
 
 
 #endif //TEXTCHANGEORDER_H
@@ -0,0 +1,106 @@
+//
+// Standalone check of the Displayer's render thread; not part of led-timer-display. Needs no LED panel: the
+// frames are drawn, but not shown. Run with 'make check'.
+//
+// Posts orders and waits for their zone to report them done, as the main loop does before it handles the next
+// message for that zone. An order that is never done holds up every message after it.
+//   displayer-check [-t <timeout-msec>]
+//
+
+#include "Displayer.h"
+#include "TextChangeOrder.h"
+#include "../lib/check-internal.h"
+
+#include <unistd.h>  // getopt, usleep
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+static int timeoutMsec = 2000;
+
+// true once the zone reports the order done, false if it doesn't in time
+static bool waitDone(const Displayer& displayer, int zone) {
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMsec);
+    while (!displayer.isChangeOrderDone(zone)) {
+        if (std::chrono::steady_clock::now() > deadline) return false;
+        usleep(1000);
+    }
+    return true;
+}
+
+static TextChangeOrder staticOrder(const char* text, int zone) {
+    TextChangeOrder order(text);
+    order.setVelocity(0).setZone(zone);
+    return order;
+}
+
+// the same static text again, e.g. a repeated message or a running clock synced to what it already shows
+static void checkSameStaticOrder(Displayer& displayer) {
+    const TextChangeOrder order = staticOrder("12:34.56", 0);
+    for (int i = 0; i < 3; ++i) {
+        displayer.startChangeOrder(order);
+        CHECK(waitDone(displayer, 0), "static order #%d not done", i + 1);
+    }
+
+    displayer.startChangeOrder(staticOrder("other", 0));
+    CHECK(waitDone(displayer, 0), "other static order not done");
+    displayer.startChangeOrder(order);
+    CHECK(waitDone(displayer, 0), "static order after another one not done");
+}
+
+// the same, while another zone scrolls on
+static void checkSameStaticOrderWhileScrolling(Displayer& displayer) {
+    TextChangeOrder scrolling("scrolling on and on");
+    scrolling.setVelocity(-10).setVelocityScrollType(TextChangeOrder::CONTINUOUS).setZone(1);
+    displayer.startChangeOrder(scrolling);
+
+    const TextChangeOrder order = staticOrder("1", 0);
+    for (int i = 0; i < 3; ++i) {
+        displayer.startChangeOrder(order);
+        CHECK(waitDone(displayer, 0), "static order #%d next to a scrolling zone not done", i + 1);
+    }
+}
+
+static int usage(const char* progname) {
+    fprintf(stderr, "usage: %s [-t <timeout-msec>]\n", progname);
+    return 1;
+}
+
+int main(int argc, char* argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "t:")) != -1) {
+        switch (opt) {
+            case 't': timeoutMsec = atoi(optarg); break;
+            default: return usage(argv[0]);
+        }
+    }
+    if (timeoutMsec < 1) return usage(argv[0]);
+
+    // so that the Displayer doesn't report every order it shows
+    if (!freopen("/dev/null", "r", stdin)) {
+        perror("/dev/null");
+        return 1;
+    }
+
+    rgb_matrix::RGBMatrix::Options matrixOptions;
+    matrixOptions.rows = 16;    // a 96x16 chain of 32x16 panels, as on the boards
+    matrixOptions.cols = 32;
+    matrixOptions.chain_length = 3;
+    rgb_matrix::RuntimeOptions runtimeOptions;
+    runtimeOptions.do_gpio_init = false;   // only the frames are needed
+    runtimeOptions.drop_privileges = -1;
+    Displayer displayer(matrixOptions, runtimeOptions);
+    if (!displayer.isDisplayerOK() || !displayer.setZones({{0, 0, 48, 16}, {48, 0, 48, 16}})) {
+        printf("No Displayer without a panel.\n");
+        return 1;
+    }
+    displayer.Start();
+
+    checkSameStaticOrder(displayer);
+    checkSameStaticOrderWhileScrolling(displayer);
+
+    displayer.Stop();
+    return CheckSummary("Displayer");
+}
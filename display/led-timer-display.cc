@@ -16,7 +16,9 @@
 // along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
 
 #include <getopt.h>  // for command line options
+#include <algorithm>
 #include <csignal>
+#include <optional>
 #include <string>
 
 #include <unistd.h>  // for io on linux, also option parsing; sleep
@@ -44,6 +46,8 @@ static int usage(const char *progname) {
   fprintf(stderr, "Options:\n");
   fprintf(stderr,
           "\t-f <font-file>    : Path to *.bdf-font to be used.\n"
+          "\t-c <cache-dir>    : Directory for the binary font cache of -f.\n"
+          "\t                    Default: <font-file>.cache next to the font.\n"
           "\t-s <speed>        : Approximate letters per second. \n"
           "\t                    Positive: scroll left to right, or up to down. Negative: R->L, D->U\n"
           "\t                    Zero for no scrolling.\n"
@@ -55,6 +59,12 @@ static int usage(const char *progname) {
           "\t-B <r,g,b>        : Background-Color. Default 0,0,0 (black)\n"
           "\t-v <0 or 1>       : Vertical scrolling (1).  Default is horizontal (0)\n"
           "\t-i <scroll style> : 0=Infinite scroll past and loop, 1=Scroll on and stop, 2=Scroll past and stop\n"
+          "\t-r <digits>       : Running times tick on locally between timer messages, with 1 (tenths)\n"
+          "\t                    or 2 (hundredths) digits. Default 0: shown as received\n"
+          "\t-Z <l,t,w,h>      : Zone of the panel: left, top, width and height. Repeat for more zones,\n"
+          "\t                    up to 10; numbered from 0 in order given. Default: one zone, the whole panel\n"
+          "\t-z <t[,b[,r]]>     : Zones for times (and text), and optionally for ALGE bibs and ranks.\n"
+          "\t                    Default: times in zone 0, no bibs, ranks after the time\n"
           );
   fprintf(stderr, "\nGeneral LED matrix options:\n");
   rgb_matrix::PrintMatrixFlags(stderr);
@@ -77,6 +87,17 @@ static bool parseColor(rgb_matrix::Color *c, const char *str) {
   return sscanf(str, "%hhu,%hhu,%hhu", &c->r, &c->g, &c->b) == 3;
 }
 
+static bool parseZone(Displayer::ZoneRect *z, const char *str) {
+  return sscanf(str, "%d,%d,%d,%d", &z->left, &z->top, &z->width, &z->height) == 4;
+}
+
+// zone numbers for times, bibs and ranks; bibs and ranks stay -1 if not given
+static bool parseFieldZones(int *timeZone, int *bibZone, int *rankZone, const char *str) {
+  const int count = sscanf(str, "%d,%d,%d", timeZone, bibZone, rankZone);
+  return count >= 1 && *timeZone >= 0
+         && (count < 2 || *bibZone >= 0) && (count < 3 || *rankZone >= 0);
+}
+
 static void do_pause() {
   sleep(3);
 }
@@ -89,53 +110,46 @@ static void showLocalAddresses(Displayer& myDisplayer, Receiver& myReceiver, con
     TextChangeOrder addr_message(textTemplate);
     addr_message.setText(local_addresses.c_str());
 
-    myDisplayer.startChangeOrder(addr_message);
-    while (!myDisplayer.isChangeOrderDone()) {
-      myDisplayer.iota();
-    }
+    myDisplayer.startChangeOrder(addr_message);  // scrolled by the Displayer's thread, while messages wait for its zone
   }
 }
 
-static void showNewConnection(Displayer& myDisplayer, const TextChangeOrder& textTemplate) {
+// returns the order to redisplay once the connection message is done, if any; the main loop posts it
+static std::optional<TextChangeOrder> showNewConnection(Displayer& myDisplayer, const TextChangeOrder& textTemplate) {
 
   std::string connectionText = "Connected";
 
   TextChangeOrder addr_message(textTemplate);
   addr_message.setString(connectionText);
 
-  TextChangeOrder origDisplayedOrder = myDisplayer.getChangeOrder();  // copy the prior order
+  TextChangeOrder origDisplayedOrder = myDisplayer.getChangeOrder(addr_message.getZone());  // copy the prior order
 
   myDisplayer.startChangeOrder(addr_message);
-  while (!myDisplayer.isChangeOrderDone()) {
-    myDisplayer.iota();
-  }
 
   // if previously displayed order ends onscreen, redisplay
   if (origDisplayedOrder.isScrolling()) { // velocity non-zero
     switch (origDisplayedOrder.getVelocityScrollType()) {
       case TextChangeOrder::SINGLE_ONOFF:
         // no redisplay
-        break;
+        return std::nullopt;
 
       case TextChangeOrder::SINGLE_ON:
         origDisplayedOrder.setVelocity(0);  // modify to skip rescrolling. just re-display
-        myDisplayer.startChangeOrder(origDisplayedOrder);
-        break;
+        return origDisplayedOrder;
 
       case TextChangeOrder::CONTINUOUS: // resume continuous scroll
-        myDisplayer.startChangeOrder(origDisplayedOrder);
-        break;
+        return origDisplayedOrder;
       default:
-        myDisplayer.startChangeOrder(origDisplayedOrder);
-        break;
+        return origDisplayedOrder;
     }
   }
   else {  // not scrolling
-    myDisplayer.startChangeOrder(origDisplayedOrder);
+    return origDisplayedOrder;
   }
 }
 
-static void updateReportConnections(Displayer& myDisplayer, Receiver& myReceiver, const TextChangeOrder& textTemplate, bool& currIsNoKnown, const bool forceReport = false) {
+static void updateReportConnections(Displayer& myDisplayer, Receiver& myReceiver, const TextChangeOrder& textTemplate, bool& currIsNoKnown,
+                                    std::optional<TextChangeOrder>& restoreOrder, const bool forceReport = false) {
   // update display's marker of "no connection" status
   const bool newIsNoKnownConnections = myReceiver.isNoActiveSourceOrPending();
 
@@ -155,7 +169,10 @@ static void updateReportConnections(Displayer& myDisplayer, Receiver& myReceiver
         // Only give a message if we are interactive. If connected via pipe, be quiet
         printf("Displaying active connection message%s\n", (forceReport ? " (forced check)" : ""));
       }
-      showNewConnection(myDisplayer, textTemplate);
+      std::optional<TextChangeOrder> origDisplayedOrder = showNewConnection(myDisplayer, textTemplate);
+      if (!restoreOrder) {
+        restoreOrder = origDisplayedOrder;  // else still the order shown before an earlier connection message
+      }
     }
   }
 
@@ -178,6 +195,7 @@ int main(int argc, char *argv[]) {
   rgb_matrix::Color bg_color = TextChangeOrder::getDefaultBackgroundColor();
 
   std::string bdf_font_file_name; // empty means "use default"
+  std::string font_cache_dir;     // empty means "next to font file"
   std::string line;               // default to empty string displayed
   int x_orig = TextChangeOrder::getXOriginDefault();
   int y_orig = TextChangeOrder::getYOriginDefault();
@@ -187,14 +205,21 @@ int main(int argc, char *argv[]) {
   bool set_horizontal_scroll = true;
   TextChangeOrder::ScrollType set_scroll_type = TextChangeOrder::SINGLE_ONOFF;
 
+  int running_clock_digits = 0;
+  std::vector<Displayer::ZoneRect> zones;   // empty means one zone, the whole panel
+  int time_zone = 0;
+  int bib_zone = -1;    // -1: bibs are not shown
+  int rank_zone = -1;   // -1: ranks follow the time
+
   int port_number = Receiver::TCP_PORT_DEFAULT;
   int opt;
-  while ((opt = getopt(argc, argv, "x:y:f:C:B:t:s:p:v:i:Q")) != -1) {  // ':' suffix indicates required argument
+  while ((opt = getopt(argc, argv, "x:y:f:c:C:B:t:s:p:v:i:r:Z:z:Q")) != -1) {  // ':' suffix indicates required argument
     switch (opt) {
     case 's': speed = atof(optarg); break;
     case 'x': x_orig = atoi(optarg); break;
     case 'y': y_orig = atoi(optarg); break;
     case 'f': bdf_font_file_name = optarg; break;
+    case 'c': font_cache_dir = optarg; break;
     case 't': letter_spacing = atoi(optarg); break;
     case 'v': set_horizontal_scroll = atoi(optarg) == 0; break;
     case 'i':
@@ -203,6 +228,28 @@ int main(int argc, char *argv[]) {
       else if (atoi(optarg) == TextChangeOrder::CONTINUOUS) set_scroll_type = TextChangeOrder::CONTINUOUS;
       else fprintf(stderr, "Invalid scroll type spec: %s\n", optarg);
       break;
+    case 'r':
+      running_clock_digits = atoi(optarg);
+      if (running_clock_digits < 0 || running_clock_digits > 2) {
+        fprintf(stderr, "Invalid running clock digits: %s\n", optarg);
+        return usage(argv[0]);
+      }
+      break;
+    case 'Z': {
+      Displayer::ZoneRect zone;
+      if (!parseZone(&zone, optarg)) {
+        fprintf(stderr, "Invalid zone spec: %s\n", optarg);
+        return usage(argv[0]);
+      }
+      zones.push_back(zone);
+      break;
+    }
+    case 'z':
+      if (!parseFieldZones(&time_zone, &bib_zone, &rank_zone, optarg)) {
+        fprintf(stderr, "Invalid field zones spec: %s\n", optarg);
+        return usage(argv[0]);
+      }
+      break;
     case 'C':
       if (!parseColor(&fg_color, optarg)) {
         fprintf(stderr, "Invalid color spec: %s\n", optarg);
@@ -261,7 +308,8 @@ int main(int argc, char *argv[]) {
   }
   else {
     fontPtr = new rgb_matrix::Font();
-    if (!fontPtr->LoadFont(bdf_font_file_name.c_str())) {
+    if (!fontPtr->LoadFontWithCache(bdf_font_file_name.c_str(),
+                                    font_cache_dir.c_str())) {
       fprintf(stderr, "Couldn't load font '%s'\n", bdf_font_file_name.c_str());
       return 1;
     }
@@ -271,13 +319,20 @@ int main(int argc, char *argv[]) {
   baseOrderTemplate.setForegroundColor(fg_color).setBackgroundColor(bg_color)
                    .setVelocity(speed).setVelocityIsHorizontal(set_horizontal_scroll)
                    .setVelocityScrollType(set_scroll_type)
-                   .setXOrigin(x_orig).setYOrigin(y_orig);
+                   .setXOrigin(x_orig).setYOrigin(y_orig)
+                   .setZone(time_zone);
   //const int baseTextTemplateIndex = 
     TextChangeOrder::registerTemplate(baseOrderTemplate);       
 
+  // bibs and ranks look like the times, but stay in place in their own zones
+  TextChangeOrder bibOrderTemplate(baseOrderTemplate);
+  bibOrderTemplate.setVelocity(0).setZone(bib_zone);
+  TextChangeOrder rankOrderTemplate(baseOrderTemplate);
+  rankOrderTemplate.setVelocity(0).setZone(rank_zone);
+
   SpacedFont smallSpacedFont(nullptr,0);  // specific letter spacing
   rgb_matrix::Font smallFont;
-  if (smallFont.ReadFont(BDF_5X7_STRING)) {
+  if (smallFont.ReadFont(BDF_5X7_STRING, SpacedFont::getDisplayableCharacters())) {
     smallSpacedFont.fontPtr = &smallFont;
   }
   else {
@@ -313,28 +368,31 @@ int main(int argc, char *argv[]) {
                           
   // ****************************************************************************
   Displayer myDisplayer(matrix_options, runtime_opt);
+  if (!zones.empty() && myDisplayer.isDisplayerOK() && !myDisplayer.setZones(zones)) {
+    return usage(argv[0]);
+  }
+  if (myDisplayer.isDisplayerOK() && std::max({time_zone, bib_zone, rank_zone}) >= myDisplayer.getNumZones()) {
+    fprintf(stderr, "Field zones %d,%d,%d: only %d zone(s)\n", time_zone, bib_zone, rank_zone, myDisplayer.getNumZones());
+    return usage(argv[0]);
+  }
+  myDisplayer.Start();
   bool report_when_display_emptied = false;
+  int report_zone = 0;   // zone of the order to watch for an empty display
 
   Receiver::setPreferredCommandFormatTemplate(smallVerticalScrollTextTemplateIndex);  // set as default for display of command responses
   Receiver myReceiver(port_number);
   myReceiver.Start();
 
-  MessageFormatter myFormatter(myDisplayer, baseOrderTemplate);
+  MessageFormatter myFormatter(myDisplayer, baseOrderTemplate, running_clock_digits);
+  if (bib_zone >= 0) myFormatter.setBibOrderFormat(bibOrderTemplate);
+  if (rank_zone >= 0) myFormatter.setRankOrderFormat(rankOrderTemplate);
 
   // ****************************************************************************
   // initial display of address connection text (we are awake, but perhaps not yet connected)
   showLocalAddresses(myDisplayer, myReceiver, smallFontHorizontalScrollTemplate);
 
-  // now show text from command line options
-  Receiver::RawMessage startup_message(Receiver::Protocol::SIMPLE_TEXT, line);
-  if (myFormatter.handleMessage(startup_message)) {
-    const TextChangeOrder& currChangeOrder = myDisplayer.getChangeOrder();
-
-    // if text empty or scrolls across and stops as an empty display, watch for completion
-    report_when_display_emptied = currChangeOrder.orderDoneHasEmptyDisplay();
-
-    myReceiver.reportDisplayed(currChangeOrder.toUPLCFormattedMessage());  
-  }
+  // then text from command line options, from the main loop once its zone is done, before any received message
+  std::optional<Receiver::RawMessage> startup_message(std::in_place, Receiver::Protocol::SIMPLE_TEXT, line);
 
   signal(SIGTERM, InterruptHandler);
   signal(SIGINT, InterruptHandler);
@@ -344,41 +402,57 @@ int main(int argc, char *argv[]) {
   }
 
   bool currIsNoActiveSource = false;
-  updateReportConnections(myDisplayer, myReceiver, smallFontVerticalScrollTemplate, currIsNoActiveSource, 
+  std::optional<TextChangeOrder> restore_order;  // shown again once the connection message is done
+  updateReportConnections(myDisplayer, myReceiver, smallFontVerticalScrollTemplate, currIsNoActiveSource, restore_order,
                           true);  // force report of initial connection status
                  
   // ****************************************************************************
   while (!interrupt_received) {
 
-    updateReportConnections(myDisplayer, myReceiver, smallFontVerticalScrollTemplate, currIsNoActiveSource);
+    updateReportConnections(myDisplayer, myReceiver, smallFontVerticalScrollTemplate, currIsNoActiveSource, restore_order);
 
-    // when previous message has been shown (possibly restarted scrolling if continuous), check for new messages
-    if (myDisplayer.isChangeOrderDone()) {   
+    if (restore_order && myDisplayer.isChangeOrderDone(restore_order->getZone())) {
+      myDisplayer.startChangeOrder(*restore_order);
+      restore_order.reset();
+    }
 
-      // if new valid message,  decide what to display
-      if (myReceiver.isPendingMessage()) {
-        const Receiver::RawMessage message = myReceiver.popPendingMessage();
-        const bool new_display = myFormatter.handleMessage(message);
-        if (new_display) {
-          const TextChangeOrder& currChangeOrder = myDisplayer.getChangeOrder();
+    if (startup_message && myFormatter.isReadyFor(*startup_message)) {
+      if (myFormatter.handleMessage(*startup_message)) {
+        const TextChangeOrder& currChangeOrder = myDisplayer.getChangeOrder();
 
-          // if text empty or scrolls across and stops as an empty display, watch for completion
-          report_when_display_emptied = currChangeOrder.isScrolling() && currChangeOrder.orderDoneHasEmptyDisplay();
+        // if text empty or scrolls across and stops as an empty display, watch for completion
+        report_when_display_emptied = currChangeOrder.orderDoneHasEmptyDisplay();
+        report_zone = currChangeOrder.getZone();
 
-          myReceiver.reportDisplayed(currChangeOrder.toUPLCFormattedMessage());  
-        }
+        myReceiver.reportDisplayed(currChangeOrder.toUPLCFormattedMessage());
       }
+      startup_message.reset();
     }
 
-    myDisplayer.iota();
+    // when the zones the next message goes to have shown their previous orders (possibly restarted scrolling if
+    // continuous), decide what to display; other zones may still be scrolling
+    if (!startup_message && myReceiver.isPendingMessage() && myFormatter.isReadyFor(myReceiver.peekPendingMessage())) {
+      const Receiver::RawMessage message = myReceiver.popPendingMessage();
+      const bool new_display = myFormatter.handleMessage(message);
+      if (new_display) {
+        const TextChangeOrder& currChangeOrder = myDisplayer.getChangeOrder();
+
+        // if text empty or scrolls across and stops as an empty display, watch for completion
+        report_when_display_emptied = currChangeOrder.isScrolling() && currChangeOrder.orderDoneHasEmptyDisplay();
+        report_zone = currChangeOrder.getZone();
+
+        myReceiver.reportDisplayed(currChangeOrder.toUPLCFormattedMessage());  
+      }
+    }
 
-    if (report_when_display_emptied && myDisplayer.isChangeOrderDone()) {            
+    if (report_when_display_emptied && myDisplayer.isChangeOrderDone(report_zone)) {            
       myReceiver.reportDisplayed(TextChangeOrder("").toUPLCFormattedMessage());  // report empty display
       report_when_display_emptied = false;
     }
 
     // when no messages can be received, and there is nothing to scroll, delay quite a while before looping
-    if (!myReceiver.isRunning() && !myDisplayer.isContinuousScroll() && myDisplayer.isChangeOrderDone()) {
+    if (!myReceiver.isRunning() && !myDisplayer.isContinuousScroll() && myDisplayer.isChangeOrderDone()
+        && !restore_order && !startup_message) {
       do_pause();
     }
     else {
@@ -389,6 +463,13 @@ int main(int argc, char *argv[]) {
   }
   fprintf(stderr,"Interrupt received\n");
 
+  rgb_matrix::RGBMatrix::RefreshStats refresh_stats;
+  if (myDisplayer.getRefreshStats(&refresh_stats)) {
+    fprintf(stderr,"Panel refresh: %llu frames, mean %.1fHz, lowest %.1fHz, %llu missed deadlines, %llu swaps\n",
+            (unsigned long long)refresh_stats.frames, refresh_stats.mean_hz(), refresh_stats.min_hz(),
+            (unsigned long long)refresh_stats.missed_deadlines, (unsigned long long)refresh_stats.swaps);
+  }
+
   // ****************************************************************************
   myReceiver.Stop();
 
@@ -0,0 +1,250 @@
+//
+// Standalone check and benchmark of the UPLC formatted text encoding of TextChangeOrder; not part of
+// led-timer-display. Needs no LED panel. Run with 'make check' or 'make bench'.
+//
+// The check round-trips random orders, makes sure malformed fields are rejected instead of read the way
+// sscanf() would read them, and decodes randomly mutated messages: whatever is accepted must encode to a
+// message that decodes to the same order again.
+//   uplc-codec-check [-n <orders>] [-s <seed>] [-v] [-b]
+//     -v: show the decoder's messages about rejected input
+//     -b: time encoding and decoding instead
+//
+
+#include "TextChangeOrder.h"
+#include "../lib/check-internal.h"
+
+#include <unistd.h>  // getopt
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+static rgb_matrix::Font otherFont;   // never loaded; only its address is used
+static constexpr int NUM_TEST_FONTS = 3;
+static constexpr size_t MAX_SENT_TEXT_LENGTH = 55;   // longer texts are sent cut short
+
+// printable, so that failures can be reported
+static std::string escaped(const std::string& message) {
+    std::string result;
+    for (const unsigned char c : message) {
+        if (c < ' ' || c > '~') {
+            char hex[8];
+            snprintf(hex, sizeof(hex), "\\x%02x", c);
+            result += hex;
+        }
+        else {
+            result += static_cast<char>(c);
+        }
+    }
+    return result;
+}
+
+static bool isSameOrder(const TextChangeOrder& a, const TextChangeOrder& b) {
+    return a.getForegroundColor().r == b.getForegroundColor().r
+           && a.getForegroundColor().g == b.getForegroundColor().g
+           && a.getForegroundColor().b == b.getForegroundColor().b
+           && a.getBackgroundColor().r == b.getBackgroundColor().r
+           && a.getBackgroundColor().g == b.getBackgroundColor().g
+           && a.getBackgroundColor().b == b.getBackgroundColor().b
+           && a.getVelocity() == b.getVelocity()
+           && a.getVelocityIsHorizontal() == b.getVelocityIsHorizontal()
+           && a.getVelocityScrollType() == b.getVelocityScrollType()
+           && a.getXOrigin() == b.getXOrigin() && a.getYOrigin() == b.getYOrigin()
+           && a.getZone() == b.getZone()
+           && a.getSpacedFont().equals(b.getSpacedFont())
+           && a.getString() == b.getString();
+}
+
+// an order with every field the format carries set at random, to values it can carry
+static TextChangeOrder randomOrder(std::mt19937& rng) {
+    auto random = [&rng](int n) {return static_cast<int>(rng() % n);};
+    TextChangeOrder order;
+    order.setForegroundColor(rgb_matrix::Color(random(256), random(256), random(256)))
+         .setBackgroundColor(rgb_matrix::Color(random(256), random(256), random(256)));
+
+    // a speed written with one decimal, as the format has it
+    const int maxTenths = (random(4) == 0) ? 999999 : 2000;
+    char velocity[16];
+    snprintf(velocity, sizeof(velocity), "%.1f", (random(2 * maxTenths + 1) - maxTenths) / 10.0);
+    order.setVelocity(strtof(velocity, nullptr));
+
+    order.setVelocityIsHorizontal(random(2) == 1)
+         .setVelocityScrollType(static_cast<TextChangeOrder::ScrollType>(random(3)))
+         .setXOrigin((random(4) == 0) ? random(65536) - 32768 : random(401) - 200)
+         .setYOrigin((random(4) == 0) ? random(65536) - 32768 : random(401) - 200)
+         .setZone(random(2) ? 0 : random(10));
+    if (random(4) != 0) order.setSpacedFont(SpacedFont::getRegisteredSpacedFont(random(NUM_TEST_FONTS)));
+
+    std::string text;
+    const int length = random(MAX_SENT_TEXT_LENGTH + 1);
+    for (int i = 0; i < length; ++i) text += static_cast<char>(' ' + random(95));
+    order.setString(text);
+    return order;
+}
+
+static void checkRoundTrip(std::mt19937& rng, int count, std::vector<std::string>* encoded) {
+    for (int i = 0; i < count; ++i) {
+        const TextChangeOrder order = randomOrder(rng);
+        const std::string message = order.toUPLCFormattedMessage();
+        TextChangeOrder decoded;
+        const bool isDecoded = decoded.fromUPLCFormattedMessage(message);
+        CHECK(isDecoded, "rejected its own message %s", escaped(message).c_str());
+        CHECK(!isDecoded || isSameOrder(order, decoded), "%s decoded as %s", escaped(message).c_str(),
+              escaped(decoded.toUPLCFormattedMessage()).c_str());
+        encoded->push_back(message);
+    }
+}
+
+// each field of a valid message replaced with what sscanf() would have read, one at a time
+static void checkRejected() {
+    static const char* const MALFORMED_FIELDS[][2] = {
+        {"F102030", "F-10203"},     // signed hex
+        {"F102030", "F+10203"},
+        {"F102030", "F0x1020"},     // hex prefix
+        {"F102030", "F 10203"},     // leading blank
+        {"F102030", "F1020"},       // short
+        {"B405060", "B40506g"},
+        {"V+01.5", "V 01.5"},
+        {"V+01.5", "V01.50"},       // no sign
+        {"V+01.5", "V+1.5"},        // one integer digit
+        {"V+01.5", "V+01.5x"},      // rest of the field
+        {"V+01.5", "V+01."},
+        {"V+01.5", "V+0x1.5"},
+        {"V+01.5", "V+inf"},
+        {"V+01.5", "V+123456.0"},   // more than the encoder writes
+        {"X+03", "X+3a"},           // rest of the field
+        {"X+03", "X 03"},
+        {"X+03", "X003"},           // no sign
+        {"X+03", "X+3"},            // one digit
+        {"X+03", "X+40000"},        // not an int16_t
+        {"Y-04", "Y--4"},
+        {"D1", "D2"},
+        {"D1", "D-"},
+        {"S1", "S3"},
+        {"S1", "S+"},
+        {"Z4", "Z-1"},
+        {"Z4", "Z "},
+    };
+
+    TextChangeOrder order;
+    order.setForegroundColor(rgb_matrix::Color(0x10, 0x20, 0x30)).setBackgroundColor(rgb_matrix::Color(0x40, 0x50, 0x60))
+         .setVelocity(1.5f).setVelocityIsHorizontal(true).setVelocityScrollType(TextChangeOrder::SINGLE_ON)
+         .setXOrigin(3).setYOrigin(-4).setZone(4).setString("12:34.56");
+    const std::string valid = order.toUPLCFormattedMessage();
+    TextChangeOrder decoded;
+    CHECK(decoded.fromUPLCFormattedMessage(valid), "rejected %s", escaped(valid).c_str());
+
+    for (const auto& field : MALFORMED_FIELDS) {
+        std::string message = valid;
+        const size_t pos = message.find(field[0]);
+        CHECK(pos != std::string::npos, "no field %s in %s", field[0], escaped(valid).c_str());
+        if (pos == std::string::npos) continue;
+        message.replace(pos, strlen(field[0]), field[1]);
+        CHECK(!decoded.fromUPLCFormattedMessage(message), "accepted %s", escaped(message).c_str());
+    }
+}
+
+// accepted messages must be read the same when sent back as they were encoded, apart from a text cut short
+static void checkMutated(std::mt19937& rng, int count, const std::vector<std::string>& encoded) {
+    static const char ALPHABET[] = "0123456789abcdefABCDEF+-. xX=!FBVXYDSZ\r~/\t";
+    auto random = [&rng](int n) {return static_cast<int>(rng() % n);};
+    int accepted = 0;
+    for (int i = 0; i < count; ++i) {
+        std::string message = encoded[random(encoded.size())];
+        for (int edits = 1 + random(3); edits > 0; --edits) {
+            const size_t pos = random(message.size());
+            const char c = ALPHABET[random(sizeof(ALPHABET) - 1)];
+            switch (random(3)) {
+                case 0: message[pos] = c; break;
+                case 1: message.insert(message.begin() + pos, c); break;
+                default: if (message.size() > 1) message.erase(pos, 1); break;
+            }
+        }
+        TextChangeOrder decoded;
+        if (!decoded.fromUPLCFormattedMessage(message)) continue;
+        ++accepted;
+        decoded.setString(decoded.getString().substr(0, MAX_SENT_TEXT_LENGTH));
+        const std::string reencoded = decoded.toUPLCFormattedMessage();
+        TextChangeOrder again;
+        CHECK(again.fromUPLCFormattedMessage(reencoded), "%s reencoded as %s, then rejected",
+              escaped(message).c_str(), escaped(reencoded).c_str());
+        CHECK(isSameOrder(decoded, again), "%s reencoded as %s, decoded as %s", escaped(message).c_str(),
+              escaped(reencoded).c_str(), escaped(again.toUPLCFormattedMessage()).c_str());
+    }
+    printf("%d of %d mutated messages accepted\n", accepted, count);
+}
+
+static void benchmark() {
+    TextChangeOrder order;
+    order.setText(" 1  Rider Name      12:34.56").setVelocity(-7.5f).setXOrigin(3).setYOrigin(-2)
+         .setForegroundColor(rgb_matrix::Color(255, 128, 0));
+    char message[TextChangeOrder::UPLC_FORMATTED_MAX_LENGTH];
+    const size_t length = order.toUPLCFormattedMessage(message, sizeof(message));
+
+    constexpr int ROUNDS = 2000000;
+    static volatile size_t sink;   // so that the loops are not optimized away
+    char buffer[TextChangeOrder::UPLC_FORMATTED_MAX_LENGTH];
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < ROUNDS; ++i) {
+        sink += order.toUPLCFormattedMessage(buffer, sizeof(buffer));
+    }
+    const auto encoded = std::chrono::steady_clock::now();
+    for (int i = 0; i < ROUNDS; ++i) {
+        TextChangeOrder decoded;
+        sink += decoded.fromUPLCFormattedMessage(message, length);
+    }
+    const auto decoded = std::chrono::steady_clock::now();
+
+    const double encodeNanos = std::chrono::duration<double, std::nano>(encoded - start).count() / ROUNDS;
+    const double decodeNanos = std::chrono::duration<double, std::nano>(decoded - encoded).count() / ROUNDS;
+    printf("%.*s\n", static_cast<int>(length - TextChangeOrder::UPLC_FORMATTED_SUFFIX.length()), message);
+    printf("encode: %6.0f ns (%5.2f M/s)\n", encodeNanos, 1e3 / encodeNanos);
+    printf("decode: %6.0f ns (%5.2f M/s)\n", decodeNanos, 1e3 / decodeNanos);
+}
+
+static int usage(const char* progname) {
+    fprintf(stderr, "usage: %s [-n <orders>] [-s <seed>] [-v] [-b]\n", progname);
+    return 1;
+}
+
+int main(int argc, char* argv[]) {
+    int count = 100000;
+    unsigned seed = 1;
+    bool isVerbose = false;
+    bool isBenchmark = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:s:vb")) != -1) {
+        switch (opt) {
+            case 'n': count = atoi(optarg); break;
+            case 's': seed = strtoul(optarg, nullptr, 10); break;
+            case 'v': isVerbose = true; break;
+            case 'b': isBenchmark = true; break;
+            default: return usage(argv[0]);
+        }
+    }
+    if (count < 1) return usage(argv[0]);
+
+    SpacedFont::registerFont(SpacedFont(nullptr, -1));
+    SpacedFont::registerFont(SpacedFont(nullptr, 0));
+    SpacedFont::registerFont(SpacedFont(&otherFont, 1));
+
+    if (isBenchmark) {
+        benchmark();
+        return 0;
+    }
+
+    if (!isVerbose && !freopen("/dev/null", "w", stderr)) {   // rejected input is reported there
+        perror("/dev/null");
+        return 1;
+    }
+    std::mt19937 rng(seed);
+    std::vector<std::string> encoded;
+    checkRoundTrip(rng, count, &encoded);
+    checkRejected();
+    checkMutated(rng, 4 * count, encoded);
+    return CheckSummary("UPLC format");
+}
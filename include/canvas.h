@@ -18,6 +18,8 @@
 #include <stdint.h>
 
 namespace rgb_matrix {
+struct Color;
+
 // An interface for things a Canvas can do. The RGBMatrix implements this
 // interface, so you can use it directly wherever a canvas is needed.
 //
@@ -41,6 +43,20 @@ public:
   virtual void SetPixel(int x, int y,
                         uint8_t red, uint8_t green, uint8_t blue) = 0;
 
+  // Set "length" pixels in row "y", starting at "x" and going right, to the
+  // same color. Implementations can override this to do the color mapping
+  // only once per run instead of once per pixel.
+  virtual void SetPixelRun(int x, int y, int length,
+                           uint8_t red, uint8_t green, uint8_t blue) {
+    for (int i = 0; i < length; ++i) SetPixel(x + i, y, red, green, blue);
+  }
+
+  // Set a "width" x "height" rectangle of pixels starting at (x,y) from
+  // "colors", which contains width * height colors, row by row.
+  // Implementations can override this to convert whole rows at once; the
+  // default calls SetPixel() for each pixel.
+  virtual void SetPixels(int x, int y, int width, int height, Color *colors);
+
   // Clear screen to be all black.
   virtual void Clear() = 0;
 
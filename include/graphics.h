@@ -13,6 +13,7 @@
 #include <stddef.h>
 
 #include <map>
+#include <vector>
 
 namespace rgb_matrix {
 struct Color {
@@ -24,6 +25,18 @@ struct Color {
   void setColor(uint8_t rr, uint8_t gg, uint8_t bb) {r = rr; g = gg; b = bb;}
 };
 
+// Size of a run of text as it would be drawn by DrawText().
+struct TextMetrics {
+  int width;    // Pixels advanced on the screen; same as DrawText() returns.
+  int height;   // Font height.
+
+  // Bounding box of the pixels that might be set by the glyphs, relative to
+  // the start x position and the top of the font (baseline - baseline()).
+  // ink_width and ink_height are 0 if there are no such pixels (e.g. spaces).
+  int ink_x, ink_y;
+  int ink_width, ink_height;
+};
+
 // Font loading bdf files. If this ever becomes more types, just make virtual
 // base class.
 class Font {
@@ -35,6 +48,26 @@ public:
   bool LoadFont(const char *path);
   bool ReadFont(const char *font_file_as_string);
 
+  // Same as above, but only keep the glyphs for the characters in the UTF-8
+  // string "codepoint_subset" (plus the replacement glyph for unknown
+  // characters). Glyphs not in the subset are skipped without decoding,
+  // which saves memory and load time for large fonts if only a few
+  // characters are ever shown.
+  bool LoadFont(const char *path, const char *codepoint_subset);
+  bool ReadFont(const char *font_file_as_string, const char *codepoint_subset);
+
+  // Like LoadFont(), but keeps a compact binary copy of the parsed font in a
+  // cache file. Later calls for the same, unchanged, BDF file mmap() that
+  // cache instead of parsing the text again, so no per-glyph allocation is
+  // needed and several processes share the same page-cache memory.
+  //
+  // If "cache_dir" is NULL or empty, the cache is stored alongside the font
+  // as "<path>.cache". Otherwise it is stored in "cache_dir", in a file named
+  // after a hash of the font path, size and modification time.
+  // Not being able to write the cache is not an error; the font is still
+  // loaded from the BDF file.
+  bool LoadFontWithCache(const char *path, const char *cache_dir = NULL);
+
   // Return height of font in pixels. Returns -1 if font has not been loaded.
   int height() const { return font_height_; }
 
@@ -45,6 +78,16 @@ public:
   // does not exist.
   int CharacterWidth(uint32_t unicode_codepoint) const;
 
+  // Measure the UTF-8 text as DrawText() with the given "kerning_offset"
+  // would draw it, but only from the glyph metrics, without drawing.
+  // Nothing is cached; callers that measure the same text repeatedly should
+  // keep the result.
+  TextMetrics MeasureText(const char *utf8_text, int kerning_offset = 0) const;
+
+  // Same for an array of "count" codepoints.
+  TextMetrics MeasureGlyphRun(const uint32_t *codepoints, int count,
+                              int kerning_offset = 0) const;
+
   // Draws the unicode character at position "x","y"
   // with "color" on "background_color" (background_color can be NULL for
   // transparency.
@@ -75,13 +118,34 @@ private:
   struct Glyph;
   typedef std::map<uint32_t, Glyph*> CodepointGlyphMap;
 
+  // Layout of the binary font cache file; see bdf-font.cc
+  struct CacheHeader;
+  struct CacheGlyph;
+
   const Glyph *FindGlyph(uint32_t codepoint) const;
+  const CacheGlyph *FindCacheGlyph(uint32_t codepoint) const;
+  int AddCodepointMetrics(uint32_t codepoint, int x, TextMetrics *m) const;
+  Glyph *UnpackCacheGlyph(const CacheGlyph &g) const;
 
-  void parseLine(const char* buffer, Glyph* &current_glyph, uint32_t &codepoint, Glyph &tmp, int &row);
+  void parseLine(const char* buffer, Glyph* &current_glyph, uint32_t &codepoint, Glyph &tmp, int &row,
+                 const std::vector<uint32_t> *subset);
+
+  bool MapCacheFile(const char *cache_path,
+                    int64_t source_size, int64_t source_mtime);
+  bool WriteCacheFile(const char *cache_path,
+                      int64_t source_size, int64_t source_mtime) const;
 
   int font_height_;
   int base_line_;
   CodepointGlyphMap glyphs_;
+
+  // If loaded from a binary cache file, glyphs are not in glyphs_ but are
+  // read directly from the mmap()ed file.
+  void *mapped_data_;
+  size_t mapped_size_;
+  const CacheGlyph *mapped_glyphs_;   // Sorted by codepoint.
+  uint32_t mapped_glyph_count_;
+  const uint8_t *mapped_bitmaps_;
 };
 
 // -- Some utility functions.
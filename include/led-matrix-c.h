@@ -158,6 +158,21 @@ struct RGBLedMatrixOptions {
    * processes when waiting and renders single core boards more responsive.
    */
   bool disable_busy_waiting;     /* Corresponding flag: --led-busy-waiting */
+
+  /* Only store the bitplanes shown with the current PWM bits. Less memory
+   * for the refresh to go through with few PWM bits.
+   */
+  bool compact_bitplanes;        /* Corresponding flag: --led-compact-bitplanes */
+
+  /* Keep the colors as set next to the bitplanes of each canvas, for
+   * led_canvas_get_pixel() and led_canvas_reencode().
+   */
+  bool rgb_shadow;               /* Corresponding flag: --led-rgb-shadow */
+
+  /* If > 0, show only as many PWM bits as allow to refresh at least at
+   * this rate, measured while running.
+   */
+  int pwm_auto_tune_hz;          /* Corresponding flag: --led-pwm-auto-tune */
 };
 
 /**
@@ -333,6 +348,13 @@ void led_canvas_clear(struct LedCanvas *canvas);
 /** Fill matrix with given color. */
 void led_canvas_fill(struct LedCanvas *canvas, uint8_t r, uint8_t g, uint8_t b);
 
+/** With the rgb_shadow option: read back a pixel, or encode all pixels again
+ * with the current brightness and PWM bits. Return false without the shadow
+ * or if its content is not known. */
+bool led_canvas_get_pixel(const struct LedCanvas *canvas, int x, int y,
+                          uint8_t *r, uint8_t *g, uint8_t *b);
+bool led_canvas_reencode(struct LedCanvas *canvas);
+
 /*** API to provide double-buffering. ***/
 
 /**
@@ -356,9 +378,30 @@ struct LedCanvas *led_matrix_create_offscreen_canvas(struct RGBLedMatrix *matrix
 struct LedCanvas *led_matrix_swap_on_vsync(struct RGBLedMatrix *matrix,
                                            struct LedCanvas *canvas);
 
+/**
+ * Non-blocking version of led_matrix_swap_on_vsync(): queue the canvas
+ * to be shown on the next vsync and return a canvas that is neither shown
+ * nor queued, to draw on next. Returns NULL the first time, so use three
+ * canvases.
+ */
+struct LedCanvas *led_matrix_try_swap_on_vsync(struct RGBLedMatrix *matrix,
+                                               struct LedCanvas *canvas);
+
 uint8_t led_matrix_get_brightness(struct RGBLedMatrix *matrix);
 void led_matrix_set_brightness(struct RGBLedMatrix *matrix, uint8_t brightness);
 
+/* Change the refresh rate limit and busy waiting while running. */
+int led_matrix_get_refresh_rate_limit(struct RGBLedMatrix *matrix);
+void led_matrix_set_refresh_rate_limit(struct RGBLedMatrix *matrix, int hz);
+void led_matrix_set_busy_waiting(struct RGBLedMatrix *matrix, bool allow);
+
+/* Pixels shown on top of any canvas without changing it; see
+ * RGBMatrix::SetOverlayPixel(). */
+void led_matrix_set_overlay_pixel(struct RGBLedMatrix *matrix, int x, int y,
+                                  uint8_t r, uint8_t g, uint8_t b);
+void led_matrix_clear_overlay_pixel(struct RGBLedMatrix *matrix, int x, int y);
+void led_matrix_clear_overlay(struct RGBLedMatrix *matrix);
+
 // Utility function: set an image from the given buffer containting pixels.
 //
 // Draw image of size "image_width" and "image_height" from pixel at
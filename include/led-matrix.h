@@ -159,6 +159,55 @@ public:
     // Sleep instead of busy wait to free CPU cycles but get slightly less
     // accurate frame timing.
     bool disable_busy_waiting;   // Flag: --led-busy-waiting
+
+    // Only store the bitplanes that are shown with the current PWM bits.
+    // With few PWM bits, this makes the memory the refresh has to go through
+    // much smaller. Increasing the PWM bits of a canvas then requires
+    // redrawing it.
+    bool compact_bitplanes;      // Flag: --led-compact-bitplanes
+
+    // Keep the colors as set, three bytes per pixel, next to the bitplanes
+    // of each FrameCanvas. Allows FrameCanvas::GetPixel() and Reencode().
+    bool rgb_shadow;             // Flag: --led-rgb-shadow
+
+    // If > 0, measure the frame times while refreshing and show only as
+    // many of the pwm_bits as allow to refresh at least at this rate.
+    // Adapts continuously; see RefreshStats::auto_pwm_bits.
+    int pwm_auto_tune_hz;        // Flag: --led-pwm-auto-tune
+  };
+
+  // Statistics of the refresh thread, see GetRefreshStats().
+  // Histogram bucket i counts values in [2^(i-1), 2^i) microseconds; bucket 0
+  // is for values below one microsecond, the last one for all larger values.
+  struct RefreshStats {
+    RefreshStats();
+
+    static const int kHistogramBuckets = 20;
+
+    uint64_t frames;            // Frames shown.
+    uint64_t total_frame_usec;  // Sum of all frame times.
+    uint32_t last_frame_usec;
+    uint32_t min_frame_usec;    // Min and max only after a two second warm-up.
+    uint32_t max_frame_usec;
+    uint32_t frame_usec_histogram[kHistogramBuckets];
+
+    // With a refresh rate limit: frames that took longer than the limit
+    // allows before waiting, and how much sleeping overshot the frame time.
+    uint64_t missed_deadlines;
+    uint32_t overshoot_usec_histogram[kHistogramBuckets];
+
+    // Frames exchanged at vsync, and how long SwapOnVSync() calls blocked.
+    uint64_t swaps;
+    uint64_t swap_waits;
+    uint64_t total_swap_wait_usec;
+    uint32_t max_swap_wait_usec;
+
+    // PWM bits currently shown with Options::pwm_auto_tune_hz, otherwise 0.
+    int auto_pwm_bits;
+
+    double mean_hz() const;
+    double min_hz() const;      // From max_frame_usec.
+    double max_hz() const;      // From min_frame_usec.
   };
 
   // Factory to create a matrix. Additional functionality includes dropping
@@ -201,6 +250,10 @@ public:
   virtual int height() const;
   virtual void SetPixel(int x, int y,
                         uint8_t red, uint8_t green, uint8_t blue);
+  virtual void SetPixelRun(int x, int y, int length,
+                           uint8_t red, uint8_t green, uint8_t blue);
+  virtual void SetPixels(int x, int y, int width, int height,
+                         Color *colors);
   virtual void Clear();
   virtual void Fill(uint8_t red, uint8_t green, uint8_t blue);
 
@@ -238,6 +291,19 @@ public:
   // time-correct animations.
   FrameCanvas *SwapOnVSync(FrameCanvas *other, unsigned framerate_fraction = 1);
 
+  // Non-blocking version of SwapOnVSync() for triple-buffering: queues
+  // "other" to be shown at the next VSync and returns right away.
+  //
+  // Returns a canvas that is neither shown nor queued, to draw the next
+  // frame on: either a frame queued earlier that got replaced before it was
+  // shown, or the one that was last replaced on the screen. Returns NULL
+  // the first time, as there is no such canvas yet; so create three canvases
+  // and keep the third one for that case.
+  // Can be mixed with SwapOnVSync(): a canvas queued here that it replaces
+  // before it was shown is returned by the next TrySwapOnVSync() instead.
+  FrameCanvas *TrySwapOnVSync(FrameCanvas *other,
+                              unsigned framerate_fraction = 1);
+
   // -- Setting shape and behavior of matrix.
 
   // Apply a pixel mapper. This is used to re-map pixels according to some
@@ -258,6 +324,9 @@ public:
   //
   // This sets the PWM bits for the current active FrameCanvas and future
   // ones that are created with CreateFrameCanvas().
+  // With compact bitplanes, the active FrameCanvas keeps the planes it stores
+  // while it is shown; more PWM bits only take effect once a swap has handed
+  // it back off-screen and it is redrawn.
   bool SetPWMBits(uint8_t value);
   uint8_t pwmbits();   // return the pwm-bits of the currently active buffer.
 
@@ -270,6 +339,17 @@ public:
   void SetBrightness(uint8_t brightness);
   uint8_t brightness();
 
+  // Change the refresh rate limit while running, see
+  // Options::limit_refresh_rate_hz; <= 0 for no limit. A static display can
+  // use a low limit to save CPU and power.
+  void SetRefreshRateLimit(int limit_refresh_rate_hz);
+  int refresh_rate_limit();
+
+  // Change whether to busy wait for the refresh rate limit while running;
+  // see Options::disable_busy_waiting.
+  void SetBusyWaiting(bool allow_busy_waiting);
+  bool busy_waiting();
+
   //-- GPIO interaction.
   // This library uses the GPIO pins to drive the matrix; this is a safe way
   // to request the 'remaining' bits to be used for user purposes.
@@ -302,6 +382,40 @@ public:
   // Returns the bitmap of all GPIO input pins.
   uint64_t AwaitInputChange(int timeout_ms);
 
+  // -- Refresh statistics.
+
+  // Get statistics of the refresh so far. These are updated without locking
+  // by the refresh thread and are cheap to read.
+  // Returns false if there is no refresh running.
+  bool GetRefreshStats(RefreshStats *stats);
+
+  // Start counting from zero, e.g. after a change of content or options.
+  void ResetRefreshStats();
+
+  // -- Frame clock.
+
+  // Number of frames shown since the refresh started, and the time per
+  // frame in microseconds, averaged over the last few dozen frames. With
+  // the framerate_fraction of SwapOnVSync(), this allows to time animations
+  // in displayed frames: right after SwapOnVSync() returns, the new frame
+  // will be frame number frame_count + 1, and one swapped with a
+  // framerate_fraction of n is shown n frames after that.
+  // Returns false if there is no refresh running.
+  bool GetFrameClock(uint64_t *frame_count, float *frame_usec);
+
+  // -- Overlay.
+
+  // Pixels shown on top of whatever frame is displayed, without drawing
+  // them into any FrameCanvas: they stay through swaps and redraws, and
+  // when cleared, the frame underneath shows again. Changes show with the
+  // next frame, without a swap. Meant for a few status pixels; every row
+  // with one is a little slower to refresh. Colors are mapped with the
+  // current brightness and luminance correction. Only shown while the
+  // refresh thread runs.
+  void SetOverlayPixel(int x, int y, uint8_t red, uint8_t green, uint8_t blue);
+  void ClearOverlayPixel(int x, int y);
+  void ClearOverlay();
+
   // Request user writable GPIO bits.
   // This allows to request a bitmap of GPIO-bits to be used by the user for
   // writing.
@@ -346,6 +460,11 @@ public:
   bool SetPWMBits(uint8_t value);
   uint8_t pwmbits();
 
+  // Fewest PWM bits that show the given color exactly as with all 11 bits,
+  // with this canvas' current brightness and luminance correction. Content
+  // in a few colors can use the largest of these for a faster refresh.
+  uint8_t RequiredPWMBits(uint8_t r, uint8_t g, uint8_t b) const;
+
   // Map brightness of output linearly to input with CIE1931 profile.
   void set_luminance_correct(bool on);
   bool luminance_correct() const;
@@ -353,6 +472,20 @@ public:
   void SetBrightness(uint8_t brightness);
   uint8_t brightness();
 
+  //-- With Options::rgb_shadow, the colors as set are kept as well.
+
+  // Color last set at the given position. Returns false without the shadow,
+  // outside the canvas, or if the content came from Deserialize() or from
+  // a canvas without shadow, until the next Fill() or Clear().
+  bool GetPixel(int x, int y, uint8_t *red, uint8_t *green, uint8_t *blue) const;
+
+  // Encode all pixels again from their colors, with the current brightness,
+  // luminance correction and PWM bits; e.g. after SetBrightness() or after
+  // increasing the PWM bits with compact bitplanes. Re-encoding the frame
+  // on display shows a mix for one frame. Returns false if GetPixel()
+  // would.
+  bool Reencode();
+
   //-- Serialize()/Deserialize() are fast ways to store and re-create a canvas.
 
   // Provides a pointer to a buffer of the internal representation to
@@ -377,11 +510,19 @@ public:
   // Copy content from other FrameCanvas owned by the same RGBMatrix.
   void CopyFrom(const FrameCanvas &other);
 
+  // Copy only the pixels within the rectangle at x, y of width x height,
+  // e.g. to bring a canvas up to date with the one shown after only a small
+  // part of it changed. If the other canvas stores a different number of
+  // PWM bits (compact bitplanes), everything is copied as in CopyFrom().
+  void CopyFrom(const FrameCanvas &other, int x, int y, int width, int height);
+
   // -- Canvas interface.
   virtual int width() const;
   virtual int height() const;
   virtual void SetPixel(int x, int y,
                         uint8_t red, uint8_t green, uint8_t blue);
+  virtual void SetPixelRun(int x, int y, int length,
+                           uint8_t red, uint8_t green, uint8_t blue);
   virtual void SetPixels(int x, int y, int width, int height,
                          Color *colors);
   virtual void Clear();
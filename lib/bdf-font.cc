@@ -21,11 +21,17 @@
 #include <inttypes.h>
 
 #include "graphics.h"
+#include "utf8-internal.h"
 
+#include <fcntl.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <sstream>
+#include <string>
 
 #include <algorithm>
 #include <bitset>
@@ -47,6 +53,36 @@ struct Font::Glyph {
   std::vector<rowbitmap_t> bitmap;  // contains 'height' elements.
 };
 
+// The binary cache file is a header, followed by glyph_count CacheGlyph
+// entries sorted by codepoint, followed by the packed bitmaps. Each bitmap
+// row is row_bytes long, with the leftmost pixel in the MSB of the first byte.
+// The file is only meant to be read on the machine that wrote it, so
+// everything is stored in native byte order.
+static const char kCacheMagic[8] = { 'R', 'G', 'B', 'F', 'O', 'N', 'T', 'C' };
+static const uint32_t kCacheVersion = 2;
+
+struct Font::CacheHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t glyph_count;
+  uint32_t bitmap_bytes;
+  int32_t font_height;
+  int32_t base_line;
+  uint32_t reserved;
+  int64_t source_size;    // Size and modification time (nanoseconds) of the
+  int64_t source_mtime;   // BDF file this cache was created from.
+};
+
+struct Font::CacheGlyph {
+  uint32_t codepoint;
+  uint32_t bitmap_offset;   // Offset into the bitmap section.
+  int16_t device_width, device_height;
+  int16_t width, height;
+  int16_t x_offset, y_offset;
+  uint16_t row_bytes;
+  uint16_t reserved;
+};
+
 static bool readNibble(char c, uint8_t* val) {
   if (c >= '0' && c <= '9') { *val = c - '0'; return true; }
   if (c >= 'a' && c <= 'f') { *val = c - 'a' + 0xa; return true; }
@@ -68,20 +104,46 @@ static bool parseBitmap(const char *buffer, rowbitmap_t* result) {
   return true;
 }
 
-Font::Font() : font_height_(-1), base_line_(0) {}
+Font::Font() : font_height_(-1), base_line_(0),
+               mapped_data_(NULL), mapped_size_(0), mapped_glyphs_(NULL),
+               mapped_glyph_count_(0), mapped_bitmaps_(NULL) {}
 Font::~Font() {
   for (CodepointGlyphMap::iterator it = glyphs_.begin();
        it != glyphs_.end(); ++it) {
     delete it->second;
   }
+  if (mapped_data_) munmap(mapped_data_, mapped_size_);
+}
+
+// Sorted list of the codepoints in the UTF-8 string, plus the replacement
+// character that is drawn for unknown codepoints.
+static std::vector<uint32_t> DecodeCodepointSubset(const char *utf8_text) {
+  std::vector<uint32_t> result;
+  result.push_back(kUnicodeReplacementCodepoint);
+  while (*utf8_text) {
+    result.push_back(utf8_next_codepoint(utf8_text));
+  }
+  std::sort(result.begin(), result.end());
+  result.erase(std::unique(result.begin(), result.end()), result.end());
+  return result;
 }
 
-// TODO: that might not be working for all input files yet.
 bool Font::LoadFont(const char *path) {
+  return LoadFont(path, NULL);
+}
+
+bool Font::ReadFont(const char *font_file_as_string) {
+  return ReadFont(font_file_as_string, NULL);
+}
+
+// TODO: that might not be working for all input files yet.
+bool Font::LoadFont(const char *path, const char *codepoint_subset) {
   if (!path || !*path) return false;
   FILE *f = fopen(path, "r");
   if (f == NULL)
     return false;
+  std::vector<uint32_t> subset;
+  if (codepoint_subset) subset = DecodeCodepointSubset(codepoint_subset);
   uint32_t codepoint;
   char buffer[1024];
   Glyph tmp;
@@ -89,45 +151,231 @@ bool Font::LoadFont(const char *path) {
   int row = 0;
 
   while (fgets(buffer, sizeof(buffer), f)) {
-    parseLine(buffer, current_glyph, codepoint, tmp, row);
+    parseLine(buffer, current_glyph, codepoint, tmp, row,
+              codepoint_subset ? &subset : NULL);
   }
   fclose(f);
   return true;
 }
 
-bool Font::ReadFont(const char *font_file_as_string) {
+bool Font::ReadFont(const char *font_file_as_string,
+                    const char *codepoint_subset) {
   if (!font_file_as_string || !*font_file_as_string) return false;
+  std::vector<uint32_t> subset;
+  if (codepoint_subset) subset = DecodeCodepointSubset(codepoint_subset);
   uint32_t codepoint;
-  uint32_t BUFFER_SIZE = 1024;
+  const size_t BUFFER_SIZE = 1024;
   char buffer[BUFFER_SIZE];
   Glyph tmp;
   Glyph *current_glyph = NULL;
   int row = 0;
 
-  std::istringstream f(font_file_as_string);
-  std::string line;
-  while (std::getline(f, line)) {
-    if (line.length() < BUFFER_SIZE) {
-      strcpy(buffer, line.data());
-    }
-    else {
+  // Walk the lines in place; the built-in fonts are large enough that
+  // copying them into a stream first is noticeable at startup.
+  const char *line = font_file_as_string;
+  while (*line) {
+    const char *end = strchr(line, '\n');
+    const size_t len = end ? end - line : strlen(line);
+    if (len >= BUFFER_SIZE) {
       return false;
     }
+    memcpy(buffer, line, len);
+    buffer[len] = '\0';
+
+    parseLine(buffer, current_glyph, codepoint, tmp, row,
+              codepoint_subset ? &subset : NULL);
+    if (!end) break;
+    line = end + 1;
+  }
+  return true;
+}
+
+// FNV-1a; only used to derive a stable cache file name.
+static uint64_t HashBytes(uint64_t hash, const void *data, size_t len) {
+  const uint8_t *p = static_cast<const uint8_t*>(data);
+  for (size_t i = 0; i < len; ++i) {
+    hash ^= p[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
 
-    parseLine(buffer, current_glyph, codepoint, tmp, row);
+bool Font::LoadFontWithCache(const char *path, const char *cache_dir) {
+  if (!path || !*path) return false;
+  struct stat st;
+  if (stat(path, &st) != 0)
+    return false;
+  const int64_t source_size = st.st_size;
+  // Nanoseconds: a font rewritten within the same second is a new font.
+  const int64_t source_mtime = (int64_t)st.st_mtim.tv_sec * 1000000000
+    + st.st_mtim.tv_nsec;
+
+  std::string cache_path;
+  if (cache_dir == NULL || *cache_dir == '\0') {
+    cache_path = std::string(path) + ".cache";
+  } else {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    hash = HashBytes(hash, path, strlen(path));
+    hash = HashBytes(hash, &source_size, sizeof(source_size));
+    hash = HashBytes(hash, &source_mtime, sizeof(source_mtime));
+    char name[32];
+    snprintf(name, sizeof(name), "%016" PRIx64 ".fontcache", hash);
+    cache_path = std::string(cache_dir) + "/" + name;
   }
+
+  if (MapCacheFile(cache_path.c_str(), source_size, source_mtime))
+    return true;
+
+  if (!LoadFont(path))
+    return false;
+  WriteCacheFile(cache_path.c_str(), source_size, source_mtime);
   return true;
 }
 
- void Font::parseLine(const char* buffer, Glyph* &current_glyph, uint32_t &codepoint, Glyph &tmp, int &row) {
+bool Font::MapCacheFile(const char *cache_path,
+                        int64_t source_size, int64_t source_mtime) {
+  if (mapped_data_ || !glyphs_.empty()) return false;  // Already loaded.
+  const int fd = open(cache_path, O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(CacheHeader)
+      || (uint64_t)st.st_size > SIZE_MAX) {
+    close(fd);
+    return false;
+  }
+  const size_t size = st.st_size;
+  void *data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);  // The mapping stays valid.
+  if (data == MAP_FAILED) return false;
+
+  // Sizes are checked against what is left of the file, never summed up,
+  // so that a corrupt header can't wrap around a 32 bit size_t.
+  const CacheHeader *header = static_cast<const CacheHeader*>(data);
+  const size_t after_header = size - sizeof(CacheHeader);
+  bool valid = (memcmp(header->magic, kCacheMagic, sizeof(kCacheMagic)) == 0
+                && header->version == kCacheVersion
+                && header->source_size == source_size
+                && header->source_mtime == source_mtime
+                && header->glyph_count <= after_header / sizeof(CacheGlyph));
+  const size_t index_bytes =
+    valid ? (size_t)header->glyph_count * sizeof(CacheGlyph) : 0;
+  valid = valid && header->bitmap_bytes == after_header - index_bytes;
+  const CacheGlyph *glyphs = reinterpret_cast<const CacheGlyph*>(header + 1);
+  for (uint32_t i = 0; valid && i < header->glyph_count; ++i) {
+    const CacheGlyph &g = glyphs[i];
+    valid = ((i == 0 || glyphs[i-1].codepoint < g.codepoint)
+             && g.height >= 0 && g.row_bytes * 8 <= kMaxFontWidth
+             && g.bitmap_offset <= header->bitmap_bytes
+             && (size_t)g.height * g.row_bytes
+                <= header->bitmap_bytes - g.bitmap_offset);
+  }
+  if (!valid) {
+    munmap(data, size);
+    return false;
+  }
+
+  mapped_data_ = data;
+  mapped_size_ = size;
+  mapped_glyphs_ = glyphs;
+  mapped_glyph_count_ = header->glyph_count;
+  mapped_bitmaps_ = reinterpret_cast<const uint8_t*>(glyphs) + index_bytes;
+  font_height_ = header->font_height;
+  base_line_ = header->base_line;
+  return true;
+}
+
+bool Font::WriteCacheFile(const char *cache_path,
+                          int64_t source_size, int64_t source_mtime) const {
+  std::vector<CacheGlyph> index;
+  std::vector<uint8_t> bitmaps;
+  index.reserve(glyphs_.size());
+  for (CodepointGlyphMap::const_iterator it = glyphs_.begin();
+       it != glyphs_.end(); ++it) {
+    const Glyph *glyph = it->second;
+    // Pixels we might need: DrawGlyph() shows device_width columns, but keep
+    // the full (shifted) bounding box for CreateOutlineFont().
+    int columns = std::max(glyph->device_width,
+                           glyph->width + std::max(glyph->x_offset, 0));
+    columns = std::min(columns, kMaxFontWidth);
+    CacheGlyph g;
+    memset(&g, 0, sizeof(g));
+    g.codepoint = it->first;
+    g.bitmap_offset = bitmaps.size();
+    g.device_width = glyph->device_width;
+    g.device_height = glyph->device_height;
+    g.width = glyph->width;
+    g.height = glyph->height;
+    g.x_offset = glyph->x_offset;
+    g.y_offset = glyph->y_offset;
+    g.row_bytes = (columns + 7) / 8;
+    for (int y = 0; y < glyph->height; ++y) {
+      const rowbitmap_t &row = glyph->bitmap[y];
+      for (int b = 0; b < g.row_bytes; ++b) {
+        uint8_t packed = 0;
+        for (int bit = 0; bit < 8; ++bit) {
+          const int x = 8 * b + bit;
+          if (x < kMaxFontWidth && row.test(kMaxFontWidth - 1 - x))
+            packed |= 0x80 >> bit;
+        }
+        bitmaps.push_back(packed);
+      }
+    }
+    index.push_back(g);
+  }
+
+  CacheHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kCacheMagic, sizeof(kCacheMagic));
+  header.version = kCacheVersion;
+  header.glyph_count = index.size();
+  header.bitmap_bytes = bitmaps.size();
+  header.font_height = font_height_;
+  header.base_line = base_line_;
+  header.source_size = source_size;
+  header.source_mtime = source_mtime;
+
+  // Write to a temporary file first, so that a concurrently starting
+  // process never maps a half-written cache.
+  char tmp_path[1024];
+  snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", cache_path, (int)getpid());
+  FILE *out = fopen(tmp_path, "wb");
+  if (out == NULL) return false;
+  bool success = (fwrite(&header, sizeof(header), 1, out) == 1);
+  if (success && !index.empty())
+    success = fwrite(&index[0], sizeof(CacheGlyph), index.size(), out)
+      == index.size();
+  if (success && !bitmaps.empty())
+    success = fwrite(&bitmaps[0], 1, bitmaps.size(), out) == bitmaps.size();
+  success = (fclose(out) == 0) && success;
+  if (success) success = (rename(tmp_path, cache_path) == 0);
+  if (!success) unlink(tmp_path);
+  return success;
+}
+
+ // Value of "row" while skipping over a glyph that is not in the subset.
+static const int kSkipGlyph = -2;
+
+ void Font::parseLine(const char* buffer, Glyph* &current_glyph, uint32_t &codepoint, Glyph &tmp, int &row,
+                      const std::vector<uint32_t> *subset) {
   int dummy;
 
+  if (row == kSkipGlyph) {
+    // Only look for the end of the glyph; don't decode anything.
+    if (strncmp(buffer, "ENDCHAR", strlen("ENDCHAR")) == 0) {
+      row = -1;
+    }
+    return;
+  }
+
   if (sscanf(buffer, "FONTBOUNDINGBOX %d %d %d %d",
              &dummy, &font_height_, &dummy, &base_line_) == 4) {
     base_line_ += font_height_;
              }
   else if (sscanf(buffer, "ENCODING %ud", &codepoint) == 1) {
-    // parsed.
+    if (subset && !std::binary_search(subset->begin(), subset->end(),
+                                      codepoint)) {
+      row = kSkipGlyph;
+    }
   }
   else if (sscanf(buffer, "DWIDTH %d %d", &tmp.device_width, &tmp.device_height
                   ) == 2) {
@@ -165,8 +413,16 @@ Font *Font::CreateOutlineFont() const {
   const int kBorder = 1;
   r->font_height_ = font_height_ + 2*kBorder;
   r->base_line_ = base_line_ + kBorder;
-  for (CodepointGlyphMap::const_iterator it = glyphs_.begin();
-       it != glyphs_.end(); ++it) {
+
+  // Cached fonts don't have Glyphs; temporarily unpack them.
+  CodepointGlyphMap unpacked;
+  for (uint32_t i = 0; i < mapped_glyph_count_; ++i) {
+    unpacked[mapped_glyphs_[i].codepoint] = UnpackCacheGlyph(mapped_glyphs_[i]);
+  }
+  const CodepointGlyphMap &source = mapped_data_ ? unpacked : glyphs_;
+
+  for (CodepointGlyphMap::const_iterator it = source.begin();
+       it != source.end(); ++it) {
     const Glyph *orig = it->second;
     const int height = orig->height + 2 * kBorder;
     Glyph *const tmp_glyph = new Glyph();
@@ -198,6 +454,10 @@ Font *Font::CreateOutlineFont() const {
     }
     r->glyphs_[it->first] = tmp_glyph;
   }
+  for (CodepointGlyphMap::iterator it = unpacked.begin();
+       it != unpacked.end(); ++it) {
+    delete it->second;
+  }
   return r;
 }
 
@@ -208,14 +468,167 @@ const Font::Glyph *Font::FindGlyph(uint32_t unicode_codepoint) const {
   return found->second;
 }
 
+const Font::CacheGlyph *Font::FindCacheGlyph(uint32_t unicode_codepoint) const {
+  const CacheGlyph *begin = mapped_glyphs_;
+  const CacheGlyph *end = mapped_glyphs_ + mapped_glyph_count_;
+  while (begin < end) {
+    const CacheGlyph *mid = begin + (end - begin) / 2;
+    if (mid->codepoint == unicode_codepoint) return mid;
+    if (mid->codepoint < unicode_codepoint)
+      begin = mid + 1;
+    else
+      end = mid;
+  }
+  return NULL;
+}
+
+Font::Glyph *Font::UnpackCacheGlyph(const CacheGlyph &g) const {
+  Glyph *result = new Glyph();
+  result->device_width = g.device_width;
+  result->device_height = g.device_height;
+  result->width = g.width;
+  result->height = g.height;
+  result->x_offset = g.x_offset;
+  result->y_offset = g.y_offset;
+  result->bitmap.resize(g.height);
+  const uint8_t *bits = mapped_bitmaps_ + g.bitmap_offset;
+  for (int y = 0; y < g.height; ++y, bits += g.row_bytes) {
+    for (int x = 0; x < 8 * g.row_bytes; ++x) {
+      if (bits[x / 8] & (0x80 >> (x % 8)))
+        result->bitmap[y].set(kMaxFontWidth - 1 - x);
+    }
+  }
+  return result;
+}
+
 int Font::CharacterWidth(uint32_t unicode_codepoint) const {
+  if (mapped_data_) {
+    const CacheGlyph *g = FindCacheGlyph(unicode_codepoint);
+    return g ? g->device_width : -1;
+  }
   const Glyph *g = FindGlyph(unicode_codepoint);
   return g ? g->device_width : -1;
 }
 
+// Draw one row of a glyph "width" pixels wide, as runs of same-colored pixels.
+// "is_set(x)" tells if the pixel at x is part of the glyph.
+template <class IsSet>
+static void DrawGlyphRow(Canvas *c, int x_pos, int y_pos, int width,
+                         const Color &color, const Color *bgcolor,
+                         const IsSet &is_set) {
+  int x = 0;
+  while (x < width) {
+    const bool set = is_set(x);
+    int end = x + 1;
+    while (end < width && is_set(end) == set) ++end;
+    if (set) {
+      c->SetPixelRun(x_pos + x, y_pos, end - x, color.r, color.g, color.b);
+    } else if (bgcolor) {
+      c->SetPixelRun(x_pos + x, y_pos, end - x,
+                     bgcolor->r, bgcolor->g, bgcolor->b);
+    }
+    x = end;
+  }
+}
+
+// Add glyph "g" at "x" to the metrics. Works on both Glyph and CacheGlyph,
+// which have the same metric fields.
+template <class GlyphType>
+static int AddGlyphMetrics(const GlyphType *g, int x, int base_line,
+                           TextMetrics *m) {
+  if (g == NULL) return 0;
+  // DrawGlyph() only draws device_width columns of the shifted bitmap.
+  const int left = std::max(0, (int)g->x_offset);
+  const int right = std::min((int)g->device_width, g->x_offset + g->width);
+  const int top = base_line - g->height - g->y_offset;
+  if (right > left && g->height > 0) {
+    if (m->ink_width == 0) {
+      m->ink_x = x + left;
+      m->ink_y = top;
+      m->ink_width = right - left;
+      m->ink_height = g->height;
+    } else {
+      const int x0 = std::min(m->ink_x, x + left);
+      const int y0 = std::min(m->ink_y, top);
+      const int x1 = std::max(m->ink_x + m->ink_width, x + right);
+      const int y1 = std::max(m->ink_y + m->ink_height, top + g->height);
+      m->ink_x = x0;
+      m->ink_y = y0;
+      m->ink_width = x1 - x0;
+      m->ink_height = y1 - y0;
+    }
+  }
+  return g->device_width;
+}
+
+// Add the glyph for "codepoint" (or the replacement glyph) at "x" to the
+// metrics and return its advance.
+int Font::AddCodepointMetrics(uint32_t codepoint, int x,
+                              TextMetrics *m) const {
+  if (mapped_data_) {
+    const CacheGlyph *g = FindCacheGlyph(codepoint);
+    if (g == NULL) g = FindCacheGlyph(kUnicodeReplacementCodepoint);
+    return AddGlyphMetrics(g, x, base_line_, m);
+  }
+  const Glyph *g = FindGlyph(codepoint);
+  if (g == NULL) g = FindGlyph(kUnicodeReplacementCodepoint);
+  return AddGlyphMetrics(g, x, base_line_, m);
+}
+
+TextMetrics Font::MeasureGlyphRun(const uint32_t *codepoints, int count,
+                                  int kerning_offset) const {
+  TextMetrics result;
+  memset(&result, 0, sizeof(result));
+  result.height = font_height_;
+  int x = 0;
+  for (int i = 0; i < count; ++i) {
+    x += AddCodepointMetrics(codepoints[i], x, &result);
+    x += kerning_offset;
+  }
+  result.width = x;
+  return result;
+}
+
+TextMetrics Font::MeasureText(const char *utf8_text, int kerning_offset) const {
+  TextMetrics result;
+  memset(&result, 0, sizeof(result));
+  result.height = font_height_;
+  int x = 0;
+  for (const char *it = utf8_text; *it; /**/) {
+    x += AddCodepointMetrics(utf8_next_codepoint(it), x, &result);
+    x += kerning_offset;
+  }
+  result.width = x;
+  return result;
+}
+
 int Font::DrawGlyph(Canvas *c, int x_pos, int y_pos,
                     const Color &color, const Color *bgcolor,
                     uint32_t unicode_codepoint) const {
+  if (mapped_data_) {
+    const CacheGlyph *g = FindCacheGlyph(unicode_codepoint);
+    if (g == NULL) g = FindCacheGlyph(kUnicodeReplacementCodepoint);
+    if (g == NULL) return 0;
+    y_pos = y_pos - g->height - g->y_offset;
+
+    if (x_pos + g->device_width < 0 || x_pos > c->width() ||
+        y_pos + g->height < 0 || y_pos > c->height()) {
+      return g->device_width;  // Outside canvas border. Bail out early.
+    }
+
+    const int visible_columns = std::min((int)g->device_width,
+                                         8 * g->row_bytes);
+    const uint8_t *bits = mapped_bitmaps_ + g->bitmap_offset;
+    for (int y = 0; y < g->height; ++y, bits += g->row_bytes) {
+      DrawGlyphRow(c, x_pos, y_pos + y, g->device_width, color, bgcolor,
+                   [bits, visible_columns](int x) {
+                     return x < visible_columns
+                       && (bits[x / 8] & (0x80 >> (x % 8)));
+                   });
+    }
+    return g->device_width;
+  }
+
   const Glyph *g = FindGlyph(unicode_codepoint);
   if (g == NULL) g = FindGlyph(kUnicodeReplacementCodepoint);
   if (g == NULL) return 0;
@@ -228,13 +641,8 @@ int Font::DrawGlyph(Canvas *c, int x_pos, int y_pos,
 
   for (int y = 0; y < g->height; ++y) {
     const rowbitmap_t& row = g->bitmap[y];
-    for (int x = 0; x < g->device_width; ++x) {
-      if (row.test(kMaxFontWidth - 1 - x)) {
-        c->SetPixel(x_pos + x, y_pos + y, color.r, color.g, color.b);
-      } else if (bgcolor) {
-        c->SetPixel(x_pos + x, y_pos + y, bgcolor->r, bgcolor->g, bgcolor->b);
-      }
-    }
+    DrawGlyphRow(c, x_pos, y_pos + y, g->device_width, color, bgcolor,
+                 [&row](int x) { return row.test(kMaxFontWidth - 1 - x); });
   }
   return g->device_width;
 }
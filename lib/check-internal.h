@@ -0,0 +1,33 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+// CHECK() for the standalone check programs in lib/ and display/; not part
+// of the library. A failed check is reported on stdout, which stays open
+// when a check program silences stderr, and counted, so that the checks
+// go on and main() returns CheckSummary() at the end.
+#ifndef RPI_RGBMATRIX_CHECK_INTERNAL_H
+#define RPI_RGBMATRIX_CHECK_INTERNAL_H
+
+#include <stdio.h>
+
+static int check_failures = 0;
+
+// If "cond" is false, report it with a printf() style message.
+#define CHECK(cond, ...) do {                                     \
+    if (!(cond)) {                                                \
+      printf("%s:%d: FAILED %s: ", __FILE__, __LINE__, #cond);    \
+      printf(__VA_ARGS__);                                        \
+      printf("\n");                                               \
+      ++check_failures;                                           \
+    }                                                             \
+  } while (0)
+
+// Reports how the checks of "what" went; returns the exit code for main().
+static inline int CheckSummary(const char *what) {
+  if (check_failures) {
+    printf("%d check(s) failed.\n", check_failures);
+    return 1;
+  }
+  printf("%s: all checks passed.\n", what);
+  return 0;
+}
+
+#endif  // RPI_RGBMATRIX_CHECK_INTERNAL_H
@@ -0,0 +1,124 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+// Microbenchmark of drawing into a FrameCanvas; not part of the library.
+// Needs no LED panel. Run with 'make bench'.
+//
+// Times what a frame of text or an image costs per pixel: pixels of one
+// color, as text has them, pixels whose color keeps changing, so that every
+// one is mapped anew, and image blits through SetImage(). The difference
+// between the first and the third is what mapping a color costs.
+//   framebuffer-bench [-r <rows>] [-c <cols>] [-P <parallel>] [-b <bits>]
+
+#include "led-matrix.h"
+#include "graphics.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+using rgb_matrix::Color;
+using rgb_matrix::FrameCanvas;
+using rgb_matrix::RGBMatrix;
+
+static const int kRounds = 200;
+static const int kColors = 4096;
+
+static double NowSeconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Best of a few runs of kRounds calls, in nanoseconds per pixel.
+template <typename Draw>
+static double NanosPerPixel(FrameCanvas *canvas, Draw draw) {
+  const double pixels = (double)canvas->width() * canvas->height() * kRounds;
+  double best = 1e9;
+  for (int run = 0; run < 5; ++run) {
+    const double start = NowSeconds();
+    for (int i = 0; i < kRounds; ++i) draw(i);
+    best = std::min(best, NowSeconds() - start);
+  }
+  return best * 1e9 / pixels;
+}
+
+static void Report(const char *name, double ns) {
+  printf("%-34s %6.2f ns/pixel (%6.1f Mpx/s)\n", name, ns, 1e3 / ns);
+}
+
+static int usage(const char *progname) {
+  fprintf(stderr, "usage: %s [-r <rows>] [-c <cols>] [-P <parallel>] "
+          "[-b <pwm-bits>]\n", progname);
+  return 1;
+}
+
+int main(int argc, char *argv[]) {
+  RGBMatrix::Options options;
+  options.rows = 16;        // A 96x16 chain of 32x16 panels, as on the boards.
+  options.cols = 32;
+  options.chain_length = 3;
+  int opt;
+  while ((opt = getopt(argc, argv, "r:c:P:b:")) != -1) {
+    switch (opt) {
+    case 'r': options.rows = atoi(optarg); break;
+    case 'c': options.cols = atoi(optarg); break;
+    case 'P': options.parallel = atoi(optarg); break;
+    case 'b': options.pwm_bits = atoi(optarg); break;
+    default: return usage(argv[0]);
+    }
+  }
+
+  rgb_matrix::RuntimeOptions runtime;
+  runtime.do_gpio_init = false;   // Only the framebuffers are needed.
+  runtime.drop_privileges = -1;
+  RGBMatrix *matrix = RGBMatrix::CreateFromOptions(options, runtime);
+  if (matrix == NULL) return usage(argv[0]);
+  FrameCanvas *canvas = matrix->CreateFrameCanvas();
+  const int width = canvas->width();
+  const int height = canvas->height();
+
+  srand(1);
+  std::vector<Color> colors(kColors);
+  for (Color &c : colors) c = Color(rand(), rand(), rand());
+  std::vector<Color> image(width * height);
+  for (Color &c : image) c = colors[rand() % kColors];
+
+  printf("%dx%d canvas, %d PWM bits\n", width, height, canvas->pwmbits());
+  Report("SetPixel(), one color", NanosPerPixel(canvas, [&](int i) {
+        const Color &c = colors[i % kColors];
+        for (int y = 0; y < height; ++y)
+          for (int x = 0; x < width; ++x)
+            canvas->SetPixel(x, y, c.r, c.g, c.b);
+      }));
+  Report("SetPixel(), two colors alternating", NanosPerPixel(canvas, [&](int i) {
+        const Color &a = colors[i % kColors];
+        const Color &b = colors[(i + 1) % kColors];
+        for (int y = 0; y < height; ++y)
+          for (int x = 0; x < width; ++x) {
+            const Color &c = ((x ^ y) & 1) ? a : b;
+            canvas->SetPixel(x, y, c.r, c.g, c.b);
+          }
+      }));
+  Report("SetPixel(), every pixel new color", NanosPerPixel(canvas, [&](int i) {
+        const Color *c = &image[0];
+        for (int y = 0; y < height; ++y)
+          for (int x = 0; x < width; ++x, ++c)
+            canvas->SetPixel(x, y, (c->r + i) & 0xff, c->g, c->b);
+      }));
+  Report("SetPixelRun(), one color rows", NanosPerPixel(canvas, [&](int i) {
+        const Color &c = colors[i % kColors];
+        for (int y = 0; y < height; ++y)
+          canvas->SetPixelRun(0, y, width, c.r, c.g, c.b);
+      }));
+  Report("SetImage(), full-color blit", NanosPerPixel(canvas, [&](int i) {
+        rgb_matrix::SetImage(canvas, i & 1, 0, (const uint8_t*)&image[0],
+                             image.size() * sizeof(Color), width, height,
+                             false);
+      }));
+
+  delete matrix;
+  return 0;
+}
@@ -18,6 +18,8 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include <vector>
+
 #include "hardware-mapping.h"
 #include "../include/graphics.h"
 
@@ -31,6 +33,8 @@ class RowAddressSetter;
 // to copy between PixelMappers.
 struct PixelDesignator {
   PixelDesignator() : gpio_word(-1), r_bit(0), g_bit(0), b_bit(0), mask(~0u){}
+  // Position of the pixel in the bitplanes, independent of their layout:
+  // (double_row << 16) | column. Negative for pixels not used.
   long gpio_word;
   gpio_bits_t r_bit;
   gpio_bits_t g_bit;
@@ -60,6 +64,35 @@ private:
   PixelDesignator *const buffer_;
 };
 
+// Pixels shown on top of whatever Framebuffer is dumped, without changing it.
+// DumpToMatrix() merges them into the rows while clocking them out, so they
+// survive swaps and redraws, and removing one shows what is underneath.
+// Meant for a few pixels: a row that has any is copied once per bitplane.
+class FrameOverlay {
+public:
+  bool empty() const { return pixels_.empty(); }
+  void Remove(int x, int y);
+  void Clear() { pixels_.clear(); }
+
+private:
+  friend class Framebuffer;
+
+  struct Pixel {
+    int x, y;
+    uint8_t r, g, b;       // As set, to map again if the settings change.
+    int double_row;
+    int column;
+    gpio_bits_t r_bit, g_bit, b_bit, mask;
+    uint16_t red, green, blue;  // Mapped.
+  };
+  static bool RowLess(const Pixel &a, const Pixel &b) {
+    return a.double_row < b.double_row;
+  }
+
+  std::vector<Pixel> pixels_;   // Ordered by double row.
+  std::vector<gpio_bits_t> merged_row_;  // One bitplane of a double row.
+};
+
 // Internal representation of the frame-buffer that as well can
 // write itself to GPIO.
 // Our internal memory layout mimicks as much as possible what needs to be
@@ -87,7 +120,8 @@ public:
   Framebuffer(int rows, int columns, int parallel,
               int scan_mode,
               const char* led_sequence, bool inverse_color,
-              PixelDesignatorMap **mapper);
+              bool compact_bitplanes,
+              bool rgb_shadow, PixelDesignatorMap **mapper);
   ~Framebuffer();
 
   // Initialize GPIO bits for output. Only call once.
@@ -102,9 +136,29 @@ public:
   // Set PWM bits used for output. Default is 11, but if you only deal with
   // simple comic-colors, 1 might be sufficient. Lower require less CPU.
   // Returns boolean to signify if value was within range.
+  // With compact bitplanes, this re-arranges the buffer in place. Planes
+  // that were not stored before start out cleared, so content should be
+  // redrawn after increasing the PWM bits.
+  // Only for buffers that are not shown; see SetPWMBitsKeepLayout().
   bool SetPWMBits(uint8_t value);
+
+  // Same, but never re-arranges compact bitplanes, so it is safe on the
+  // buffer the refresh thread is showing. Until ApplyPWMBitsLayout() is
+  // called, only the planes already stored are drawn and shown.
+  bool SetPWMBitsKeepLayout(uint8_t value);
+
+  // Re-arrange compact bitplanes for PWM bits set with
+  // SetPWMBitsKeepLayout(), once the buffer is not shown anymore.
+  void ApplyPWMBitsLayout();
   uint8_t pwmbits() { return pwm_bits_; }
 
+  // Fewest PWM bits that show this color like all kBitPlanes would, with
+  // the current brightness and luminance correction.
+  uint8_t RequiredPWMBits(uint8_t r, uint8_t g, uint8_t b) const;
+
+  // Number of row pairs clocked in per bitplane.
+  int double_rows() const { return double_rows_; }
+
   // Map brightness of output linearly to input with CIE1931 profile.
   void set_luminance_correct(bool on) { do_luminance_correct_ = on; }
   bool luminance_correct() const { return do_luminance_correct_; }
@@ -116,24 +170,57 @@ public:
   }
   uint8_t brightness() { return brightness_; }
 
-  void DumpToMatrix(GPIO *io, int pwm_bits_to_show);
+  // Clock out the frame, with the pixels of "overlay" on top, if not NULL.
+  void DumpToMatrix(GPIO *io, int pwm_bits_to_show,
+                    FrameOverlay *overlay = NULL);
+
+  // Set a pixel of the overlay, with the color mapping of this framebuffer.
+  void SetOverlayPixel(FrameOverlay *overlay, int x, int y,
+                       uint8_t red, uint8_t green, uint8_t blue);
+
+  // Map all overlay pixels again, after the pixel mapper or the color
+  // settings changed. Drops those that are not on the canvas anymore.
+  void RemapOverlay(FrameOverlay *overlay);
 
   void Serialize(const char **data, size_t *len) const;
   bool Deserialize(const char *data, size_t len);
   void CopyFrom(const Framebuffer *other);
+  // Copy only the pixels in the given rectangle of the canvas.
+  void CopyFrom(const Framebuffer *other, int x, int y, int width, int height);
 
   // Canvas-inspired methods, but we're not implementing this interface to not
   // have an unnecessary vtable.
   int width() const;
   int height() const;
   void SetPixel(int x, int y, uint8_t red, uint8_t green, uint8_t blue);
+  void SetPixelRun(int x, int y, int length,
+                   uint8_t red, uint8_t green, uint8_t blue);
   void SetPixels(int x, int y, int width, int height, Color *colors);
   void Clear();
   void Fill(uint8_t red, uint8_t green, uint8_t blue);
 
+  // With an RGB shadow: the color last set at a position, and encoding
+  // all pixels again from their colors. False without a shadow, or if the
+  // content came from somewhere the colors are not known.
+  bool GetPixel(int x, int y, uint8_t *red, uint8_t *green, uint8_t *blue) const;
+  bool Reencode();
+
+  // Re-allocate the shadow for the size of a new pixel mapper, all black.
+  void ResetShadow();
+
 private:
   static const struct HardwareMapping *hardware_mapping_;
   static RowAddressSetter *row_setter_;
+  static int row_address_type_;
+
+  // The refresh loop, specialized for scan mode and row address setter so
+  // that the inner loop has no branches on either and no virtual calls.
+  // Chosen once per Framebuffer; see SelectDumpKernel().
+  typedef void (Framebuffer::*DumpKernel)(GPIO *io, int pwm_low_bit,
+                                          FrameOverlay *overlay);
+  template <bool kInterlaced, class RowSetter>
+  void DumpToMatrixKernel(GPIO *io, int pwm_low_bit, FrameOverlay *overlay);
+  static DumpKernel SelectDumpKernel(int scan_mode);
 
   // This returns the gpio-bit for given color (one of 'R', 'G', 'B'). This is
   // returning the right value in case "led_sequence" is _not_ "RGB"
@@ -144,8 +231,13 @@ private:
 
   void InitDefaultDesignator(int x, int y, const char *led_sequence,
                              PixelDesignator *designator);
+  void EncodePixels(int x, int y, int width, int height, const Color *colors);
+  void ShadowPixels(int x, int y, int width, int height, const Color *colors);
   inline void  MapColors(uint8_t r, uint8_t g, uint8_t b,
                          uint16_t *red, uint16_t *green, uint16_t *blue);
+  inline void  SetMappedPixel(const PixelDesignator *designator,
+                              uint16_t red, uint16_t green, uint16_t blue);
+
   const int rows_;     // Number of rows. 16 or 32.
   const int parallel_; // Parallel rows of chains. 1 or 2.
   const int height_;   // rows * parallel
@@ -153,13 +245,30 @@ private:
 
   const int scan_mode_;
   const bool inverse_color_;
+  gpio_bits_t color_clk_mask_;  // Color bits of all parallel chains + clock.
+  DumpKernel dump_kernel_;      // NULL until GPIO is initialized.
 
   uint8_t pwm_bits_;   // PWM bits to display.
   bool do_luminance_correct_;
   uint8_t brightness_;
 
   const int double_rows_;
-  const size_t buffer_size_;
+  const size_t buffer_size_;  // Allocated; the bitplanes might use less.
+
+  // If compact, only the pwm_bits_ planes that are shown are stored, so
+  // that refresh and copies touch less memory. Otherwise, all planes are.
+  const bool compact_bitplanes_;
+  // Only changed while the buffer is not shown.
+  int first_stored_plane_;    // Lowest plane stored in the buffer.
+  size_t row_stride_;         // gpio_bits_t words per double row.
+
+  // Optional colors as set, width() x height() of the pixel mapper when it
+  // was allocated. Not valid after content was copied in as bitplanes only.
+  const bool rgb_shadow_;
+  Color *shadow_;
+  int shadow_width_;
+  int shadow_height_;
+  bool shadow_valid_;
 
   // The frame-buffer is organized in bitplanes.
   // Highest level (slowest to cycle through) are double rows.
@@ -169,6 +278,11 @@ private:
   // but it allows easy access in the critical section.
   gpio_bits_t *bitplane_buffer_;
   inline gpio_bits_t *ValueAt(int double_row, int column, int bit);
+  inline gpio_bits_t *ValueAt(long gpio_word, int bit);
+  inline size_t used_buffer_size() const;
+  // Lowest plane drawn to: shown with the PWM bits, and stored.
+  inline int first_drawn_plane() const;
+  void RelayoutPlanes(int planes);
 
   PixelDesignatorMap **shared_mapper_;  // Storage in RGBMatrix.
 };
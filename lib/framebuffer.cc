@@ -29,6 +29,16 @@
 
 #include <algorithm>
 
+#if !defined(ENABLE_WIDE_GPIO_COMPUTE_MODULE)
+#  if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#    include <arm_neon.h>
+#    define FRAMEBUFFER_USE_NEON 1
+#  elif defined(__SSE2__)
+#    include <emmintrin.h>
+#    define FRAMEBUFFER_USE_SSE2 1
+#  endif
+#endif
+
 #include "gpio.h"
 #include "../include/graphics.h"
 
@@ -283,20 +293,28 @@ private:
 
 const struct HardwareMapping *Framebuffer::hardware_mapping_ = NULL;
 RowAddressSetter *Framebuffer::row_setter_ = NULL;
+int Framebuffer::row_address_type_ = 0;
 
 Framebuffer::Framebuffer(int rows, int columns, int parallel,
                          int scan_mode,
                          const char *led_sequence, bool inverse_color,
-                         PixelDesignatorMap **mapper)
+                         bool compact_bitplanes,
+                         bool rgb_shadow, PixelDesignatorMap **mapper)
   : rows_(rows),
     parallel_(parallel),
     height_(rows * parallel),
     columns_(columns),
     scan_mode_(scan_mode),
     inverse_color_(inverse_color),
+    color_clk_mask_(0),
+    dump_kernel_(row_setter_ ? SelectDumpKernel(scan_mode) : NULL),
     pwm_bits_(kBitPlanes), do_luminance_correct_(true), brightness_(100),
     double_rows_(rows / SUB_PANELS_),
     buffer_size_(double_rows_ * columns_ * kBitPlanes * sizeof(gpio_bits_t)),
+    compact_bitplanes_(compact_bitplanes),
+    first_stored_plane_(0), row_stride_(columns_ * kBitPlanes),
+    rgb_shadow_(rgb_shadow), shadow_(NULL),
+    shadow_width_(0), shadow_height_(0), shadow_valid_(false),
     shared_mapper_(mapper) {
   assert(hardware_mapping_ != NULL);   // Called InitHardwareMapping() ?
   assert(shared_mapper_ != NULL);  // Storage should be provided by RGBMatrix.
@@ -310,6 +328,25 @@ Framebuffer::Framebuffer(int rows, int columns, int parallel,
   }
   assert(parallel >= 1 && parallel <= 6);
 
+  const struct HardwareMapping &h = *hardware_mapping_;
+  color_clk_mask_ |= h.p0_r1 | h.p0_g1 | h.p0_b1 | h.p0_r2 | h.p0_g2 | h.p0_b2;
+  if (parallel_ >= 2) {
+    color_clk_mask_ |= h.p1_r1 | h.p1_g1 | h.p1_b1 | h.p1_r2 | h.p1_g2 | h.p1_b2;
+  }
+  if (parallel_ >= 3) {
+    color_clk_mask_ |= h.p2_r1 | h.p2_g1 | h.p2_b1 | h.p2_r2 | h.p2_g2 | h.p2_b2;
+  }
+  if (parallel_ >= 4) {
+    color_clk_mask_ |= h.p3_r1 | h.p3_g1 | h.p3_b1 | h.p3_r2 | h.p3_g2 | h.p3_b2;
+  }
+  if (parallel_ >= 5) {
+    color_clk_mask_ |= h.p4_r1 | h.p4_g1 | h.p4_b1 | h.p4_r2 | h.p4_g2 | h.p4_b2;
+  }
+  if (parallel_ >= 6) {
+    color_clk_mask_ |= h.p5_r1 | h.p5_g1 | h.p5_b1 | h.p5_r2 | h.p5_g2 | h.p5_b2;
+  }
+  color_clk_mask_ |= h.clock;
+
   bitplane_buffer_ = new gpio_bits_t[double_rows_ * columns_ * kBitPlanes];
 
   // If we're the first Framebuffer created, the shared PixelMapper is
@@ -323,7 +360,6 @@ Framebuffer::Framebuffer(int rows, int columns, int parallel,
   if (*shared_mapper_ == NULL) {
     // Gather all the bits for given color for fast Fill()s and use the right
     // bits according to the led sequence
-    const struct HardwareMapping &h = *hardware_mapping_;
     gpio_bits_t r = h.p0_r1 | h.p0_r2 | h.p1_r1 | h.p1_r2 | h.p2_r1 | h.p2_r2 | h.p3_r1 | h.p3_r2 | h.p4_r1 | h.p4_r2 | h.p5_r1 | h.p5_r2;
     gpio_bits_t g = h.p0_g1 | h.p0_g2 | h.p1_g1 | h.p1_g2 | h.p2_g1 | h.p2_g2 | h.p3_g1 | h.p3_g2 | h.p4_g1 | h.p4_g2 | h.p5_g1 | h.p5_g2;
     gpio_bits_t b = h.p0_b1 | h.p0_b2 | h.p1_b1 | h.p1_b2 | h.p2_b1 | h.p2_b2 | h.p3_b1 | h.p3_b2 | h.p4_b1 | h.p4_b2 | h.p5_b1 | h.p5_b2;
@@ -340,11 +376,13 @@ Framebuffer::Framebuffer(int rows, int columns, int parallel,
     }
   }
 
+  ResetShadow();
   Clear();
 }
 
 Framebuffer::~Framebuffer() {
   delete [] bitplane_buffer_;
+  delete [] shadow_;
 }
 
 // TODO: this should also be parsed from some special formatted string, e.g.
@@ -443,6 +481,7 @@ Framebuffer::~Framebuffer() {
   default:
     assert(0);  // unexpected type.
   }
+  row_address_type_ = row_address_type;
 
   all_used_bits |= row_setter_->need_bits();
 
@@ -567,25 +606,92 @@ static void InitFM6127(GPIO *io, const struct HardwareMapping &h, int columns) {
 }
 
 bool Framebuffer::SetPWMBits(uint8_t value) {
+  if (!SetPWMBitsKeepLayout(value))
+    return false;
+  ApplyPWMBitsLayout();
+  return true;
+}
+
+bool Framebuffer::SetPWMBitsKeepLayout(uint8_t value) {
   if (value < 1 || value > kBitPlanes)
     return false;
   pwm_bits_ = value;
   return true;
 }
 
+void Framebuffer::ApplyPWMBitsLayout() {
+  if (compact_bitplanes_ && pwm_bits_ != kBitPlanes - first_stored_plane_) {
+      RelayoutPlanes(pwm_bits_);
+  }
+}
+
+// Change the number of stored planes, keeping the highest planes of each
+// double row.
+void Framebuffer::RelayoutPlanes(int planes) {
+  const int old_planes = kBitPlanes - first_stored_plane_;
+  const size_t old_stride = row_stride_;
+  const size_t new_stride = columns_ * planes;
+  const size_t kept_bytes =
+    sizeof(gpio_bits_t) * columns_ * std::min(old_planes, planes);
+  if (planes < old_planes) {
+    // Rows move towards the front; go front to back.
+    const size_t dropped = columns_ * (old_planes - planes);
+    for (int row = 0; row < double_rows_; ++row) {
+      memmove(bitplane_buffer_ + row * new_stride,
+              bitplane_buffer_ + row * old_stride + dropped, kept_bytes);
+    }
+  } else {
+    // Rows move towards the back; go back to front.
+    const size_t added = columns_ * (planes - old_planes);
+    for (int row = double_rows_ - 1; row >= 0; --row) {
+      gpio_bits_t *new_row = bitplane_buffer_ + row * new_stride;
+      memmove(new_row + added, bitplane_buffer_ + row * old_stride,
+              kept_bytes);
+      memset(new_row, 0, sizeof(gpio_bits_t) * added);
+    }
+  }
+  row_stride_ = new_stride;
+  first_stored_plane_ = kBitPlanes - planes;
+}
+
 inline gpio_bits_t *Framebuffer::ValueAt(int double_row, int column, int bit) {
-  return &bitplane_buffer_[ double_row * (columns_ * kBitPlanes)
-                            + bit * columns_
+  return &bitplane_buffer_[ double_row * row_stride_
+                            + (bit - first_stored_plane_) * columns_
                             + column ];
 }
 
+inline gpio_bits_t *Framebuffer::ValueAt(long gpio_word, int bit) {
+  return ValueAt(gpio_word >> 16, gpio_word & 0xffff, bit);
+}
+
+inline size_t Framebuffer::used_buffer_size() const {
+  return sizeof(gpio_bits_t) * double_rows_ * row_stride_;
+}
+
+inline int Framebuffer::first_drawn_plane() const {
+  return std::max(kBitPlanes - (int)pwm_bits_, first_stored_plane_);
+}
+
 void Framebuffer::Clear() {
+  if (shadow_) {
+    std::fill(shadow_, shadow_ + shadow_width_ * shadow_height_, Color());
+    shadow_valid_ = true;
+  }
   if (inverse_color_) {
     Fill(0, 0, 0);
   } else  {
-    // Cheaper.
-    memset(bitplane_buffer_, 0,
-           sizeof(*bitplane_buffer_) * double_rows_ * columns_ * kBitPlanes);
+    // Cheaper. Only the planes that are shown need to be cleared; if that
+    // is all that is stored, the whole buffer is one block.
+    const int min_bit_plane = first_drawn_plane();
+    if (first_stored_plane_ == min_bit_plane) {
+      memset(bitplane_buffer_, 0, used_buffer_size());
+      return;
+    }
+    const size_t plane_bytes =
+      sizeof(*bitplane_buffer_) * columns_ * (kBitPlanes - min_bit_plane);
+    for (int row = 0; row < double_rows_; ++row) {
+      memset(ValueAt(row, 0, min_bit_plane), 0, plane_bytes);
+    }
   }
 }
 
@@ -644,42 +750,75 @@ inline void Framebuffer::MapColors(
   }
 }
 
+// Bits needed for one mapped color value: the planes that are not shown
+// have to be zero, unless the value is fully on, which it is with any number
+// of planes.
+static int RequiredBitsForValue(uint16_t value) {
+  constexpr int kBitPlanes = internal::Framebuffer::kBitPlanes;
+  if (value == 0 || value == (1 << kBitPlanes) - 1)
+    return 1;
+  int bits = kBitPlanes;
+  while ((value & (1 << (kBitPlanes - bits))) == 0)
+    --bits;
+  return bits;
+}
+
+uint8_t Framebuffer::RequiredPWMBits(uint8_t r, uint8_t g, uint8_t b) const {
+  // Not inverted: with inverse_color_, the planes that are not shown are
+  // dark just the same.
+  const uint8_t channels[3] = { r, g, b };
+  int bits = 1;
+  for (uint8_t c : channels) {
+    const uint16_t value = do_luminance_correct_
+      ? CIEMapColor(brightness_, c)
+      : DirectMapColor(brightness_, c);
+    bits = std::max(bits, RequiredBitsForValue(value));
+  }
+  return bits;
+}
+
 void Framebuffer::Fill(uint8_t r, uint8_t g, uint8_t b) {
+  if (shadow_) {
+    std::fill(shadow_, shadow_ + shadow_width_ * shadow_height_, Color(r, g, b));
+    shadow_valid_ = true;
+  }
   uint16_t red, green, blue;
   MapColors(r, g, b, &red, &green, &blue);
   const PixelDesignator &fill = (*shared_mapper_)->GetFillColorBits();
 
-  for (int bits = kBitPlanes - pwm_bits_; bits < kBitPlanes; ++bits) {
+  // The shown planes of a double row are stored consecutively, and look the
+  // same for every double row. So build them once in the first double row,
+  // then copy that block to all the others.
+  const int min_bit_plane = first_drawn_plane();
+  for (int bits = min_bit_plane; bits < kBitPlanes; ++bits) {
     uint16_t mask = 1 << bits;
     gpio_bits_t plane_bits = 0;
     plane_bits |= ((red & mask) == mask)   ? fill.r_bit : 0;
     plane_bits |= ((green & mask) == mask) ? fill.g_bit : 0;
     plane_bits |= ((blue & mask) == mask)  ? fill.b_bit : 0;
+    gpio_bits_t *row_data = ValueAt(0, 0, bits);
+    std::fill(row_data, row_data + columns_, plane_bits);
+  }
 
-    for (int row = 0; row < double_rows_; ++row) {
-      gpio_bits_t *row_data = ValueAt(row, 0, bits);
-      for (int col = 0; col < columns_; ++col) {
-        *row_data++ = plane_bits;
-      }
-    }
+  const gpio_bits_t *row_template = ValueAt(0, 0, min_bit_plane);
+  const size_t plane_bytes =
+    sizeof(*bitplane_buffer_) * columns_ * (kBitPlanes - min_bit_plane);
+  for (int row = 1; row < double_rows_; ++row) {
+    memcpy(ValueAt(row, 0, min_bit_plane), row_template, plane_bytes);
   }
 }
 
 int Framebuffer::width() const { return (*shared_mapper_)->width(); }
 int Framebuffer::height() const { return (*shared_mapper_)->height(); }
 
-void Framebuffer::SetPixel(int x, int y, uint8_t r, uint8_t g, uint8_t b) {
-  const PixelDesignator *designator = (*shared_mapper_)->get(x, y);
-  if (designator == NULL) return;
+inline void Framebuffer::SetMappedPixel(const PixelDesignator *designator,
+                                        uint16_t red, uint16_t green,
+                                        uint16_t blue) {
   const long pos = designator->gpio_word;
   if (pos < 0) return;  // non-used pixel marker.
 
-  uint16_t red, green, blue;
-  MapColors(r, g, b, &red, &green, &blue);
-
-  gpio_bits_t *bits = bitplane_buffer_ + pos;
-  const int min_bit_plane = kBitPlanes - pwm_bits_;
-  bits += (columns_ * min_bit_plane);
+  const int min_bit_plane = first_drawn_plane();
+  gpio_bits_t *bits = ValueAt(pos, min_bit_plane);
   const gpio_bits_t r_bits = designator->r_bit;
   const gpio_bits_t g_bits = designator->g_bit;
   const gpio_bits_t b_bits = designator->b_bit;
@@ -694,14 +833,206 @@ void Framebuffer::SetPixel(int x, int y, uint8_t r, uint8_t g, uint8_t b) {
   }
 }
 
+void Framebuffer::SetPixel(int x, int y, uint8_t r, uint8_t g, uint8_t b) {
+  const PixelDesignator *designator = (*shared_mapper_)->get(x, y);
+  if (designator == NULL) return;
+  if (shadow_) shadow_[y * shadow_width_ + x] = Color(r, g, b);
+  if (designator->gpio_word < 0) return;  // non-used pixel marker.
+
+  uint16_t red, green, blue;
+  MapColors(r, g, b, &red, &green, &blue);
+  SetMappedPixel(designator, red, green, blue);
+}
+
+void Framebuffer::SetPixelRun(int x, int y, int length,
+                              uint8_t r, uint8_t g, uint8_t b) {
+  PixelDesignatorMap *const mapper = *shared_mapper_;
+  if (y < 0 || y >= mapper->height()) return;
+  if (x < 0) {
+    length += x;
+    x = 0;
+  }
+  if (x + length > mapper->width()) length = mapper->width() - x;
+  if (length <= 0) return;
+  if (shadow_) {
+    Color *const shadow_row = shadow_ + y * shadow_width_;
+    std::fill(shadow_row + x, shadow_row + x + length, Color(r, g, b));
+  }
+
+  uint16_t red, green, blue;
+  MapColors(r, g, b, &red, &green, &blue);
+
+  // Whether each bitplane has the color set; all ones or all zeros, so that
+  // it can just be and-ed with the designator bits.
+  const int min_bit_plane = first_drawn_plane();
+  gpio_bits_t r_select[kBitPlanes], g_select[kBitPlanes], b_select[kBitPlanes];
+  for (int plane = min_bit_plane; plane < kBitPlanes; ++plane) {
+    const uint16_t mask = 1 << plane;
+    r_select[plane] = (red & mask)   ? ~(gpio_bits_t)0 : 0;
+    g_select[plane] = (green & mask) ? ~(gpio_bits_t)0 : 0;
+    b_select[plane] = (blue & mask)  ? ~(gpio_bits_t)0 : 0;
+  }
+
+  // Designators of a row are stored consecutively.
+  const PixelDesignator *designator = mapper->get(x, y);
+  for (int i = 0; i < length; ++i, ++designator) {
+    const long pos = designator->gpio_word;
+    if (pos < 0) continue;  // non-used pixel marker.
+    gpio_bits_t *bits = ValueAt(pos, min_bit_plane);
+    const gpio_bits_t r_bits = designator->r_bit;
+    const gpio_bits_t g_bits = designator->g_bit;
+    const gpio_bits_t b_bits = designator->b_bit;
+    const gpio_bits_t designator_mask = designator->mask;
+    for (int plane = min_bit_plane; plane < kBitPlanes; ++plane) {
+      *bits = ((*bits & designator_mask)
+               | (r_select[plane] & r_bits)
+               | (g_select[plane] & g_bits)
+               | (b_select[plane] & b_bits));
+      bits += columns_;
+    }
+  }
+}
+
+// Write "n" already mapped colors to consecutive words of the bitplanes,
+// all with the same designator bits. "bits" points to the first word in plane
+// "min_plane"; planes are "plane_stride" words apart.
+// This is a bit-transpose: for each plane, every pixel contributes one bit per
+// color, so we can handle several pixels per instruction.
+static void EncodePlaneRun(const uint16_t *red, const uint16_t *green,
+                           const uint16_t *blue, int n,
+                           const PixelDesignator &d, int min_plane,
+                           gpio_bits_t *bits, int plane_stride) {
+  int i = 0;
+#if defined(FRAMEBUFFER_USE_NEON)
+  const uint32x4_t r_bit = vdupq_n_u32(d.r_bit);
+  const uint32x4_t g_bit = vdupq_n_u32(d.g_bit);
+  const uint32x4_t b_bit = vdupq_n_u32(d.b_bit);
+  const uint32x4_t keep = vdupq_n_u32(d.mask);
+  for (/**/; i + 4 <= n; i += 4) {
+    const uint32x4_t r = vmovl_u16(vld1_u16(red + i));
+    const uint32x4_t g = vmovl_u16(vld1_u16(green + i));
+    const uint32x4_t b = vmovl_u16(vld1_u16(blue + i));
+    gpio_bits_t *out = bits + i;
+    for (int plane = min_plane; plane < Framebuffer::kBitPlanes; ++plane) {
+      const uint32x4_t select = vdupq_n_u32(1 << plane);
+      uint32x4_t v = vandq_u32(vld1q_u32(out), keep);
+      v = vorrq_u32(v, vandq_u32(vtstq_u32(r, select), r_bit));
+      v = vorrq_u32(v, vandq_u32(vtstq_u32(g, select), g_bit));
+      v = vorrq_u32(v, vandq_u32(vtstq_u32(b, select), b_bit));
+      vst1q_u32(out, v);
+      out += plane_stride;
+    }
+  }
+#elif defined(FRAMEBUFFER_USE_SSE2)
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i r_bit = _mm_set1_epi32(d.r_bit);
+  const __m128i g_bit = _mm_set1_epi32(d.g_bit);
+  const __m128i b_bit = _mm_set1_epi32(d.b_bit);
+  const __m128i keep = _mm_set1_epi32(d.mask);
+  for (/**/; i + 4 <= n; i += 4) {
+    const __m128i r = _mm_unpacklo_epi16(
+      _mm_loadl_epi64((const __m128i*)(red + i)), zero);
+    const __m128i g = _mm_unpacklo_epi16(
+      _mm_loadl_epi64((const __m128i*)(green + i)), zero);
+    const __m128i b = _mm_unpacklo_epi16(
+      _mm_loadl_epi64((const __m128i*)(blue + i)), zero);
+    gpio_bits_t *out = bits + i;
+    for (int plane = min_plane; plane < Framebuffer::kBitPlanes; ++plane) {
+      const __m128i select = _mm_set1_epi32(1 << plane);
+      __m128i v = _mm_and_si128(_mm_loadu_si128((__m128i*)out), keep);
+      v = _mm_or_si128(v, _mm_and_si128(
+                         _mm_cmpeq_epi32(_mm_and_si128(r, select), select),
+                         r_bit));
+      v = _mm_or_si128(v, _mm_and_si128(
+                         _mm_cmpeq_epi32(_mm_and_si128(g, select), select),
+                         g_bit));
+      v = _mm_or_si128(v, _mm_and_si128(
+                         _mm_cmpeq_epi32(_mm_and_si128(b, select), select),
+                         b_bit));
+      _mm_storeu_si128((__m128i*)out, v);
+      out += plane_stride;
+    }
+  }
+#endif
+  // Portable version; also handles the remaining pixels.
+  for (/**/; i < n; ++i) {
+    gpio_bits_t *out = bits + i;
+    for (int plane = min_plane; plane < Framebuffer::kBitPlanes; ++plane) {
+      const uint16_t mask = 1 << plane;
+      gpio_bits_t color_bits = 0;
+      if (red[i] & mask)   color_bits |= d.r_bit;
+      if (green[i] & mask) color_bits |= d.g_bit;
+      if (blue[i] & mask)  color_bits |= d.b_bit;
+      *out = (*out & d.mask) | color_bits;
+      out += plane_stride;
+    }
+  }
+}
+
 void Framebuffer::SetPixels(int x, int y, int width, int height, Color *colors) {
-  for (int iy = 0; iy < height; ++iy) {
-    for (int ix = 0; ix < width; ++ix) {
-      SetPixel(x + ix, y + iy, colors->r, colors->g, colors->b);
-      ++colors;
+  if (shadow_) ShadowPixels(x, y, width, height, colors);
+  EncodePixels(x, y, width, height, colors);
+}
+
+void Framebuffer::ShadowPixels(int x, int y, int width, int height,
+                               const Color *colors) {
+  const int x0 = std::max(x, 0), x1 = std::min(x + width, shadow_width_);
+  const int y0 = std::max(y, 0), y1 = std::min(y + height, shadow_height_);
+  if (x0 >= x1) return;
+  for (int iy = y0; iy < y1; ++iy) {
+    memcpy(shadow_ + iy * shadow_width_ + x0,
+           colors + (iy - y) * width + (x0 - x), sizeof(*shadow_) * (x1 - x0));
+  }
+}
+
+void Framebuffer::EncodePixels(int x, int y, int width, int height,
+                               const Color *colors) {
+  PixelDesignatorMap *const mapper = *shared_mapper_;
+  const int min_bit_plane = first_drawn_plane();
+  static const int kChunk = 64;
+  uint16_t red[kChunk], green[kChunk], blue[kChunk];
+  for (int iy = 0; iy < height; ++iy, colors += width) {
+    int ix = 0;
+    while (ix < width) {
+      const PixelDesignator *designator = mapper->get(x + ix, y + iy);
+      if (designator == NULL) {
+        ++ix;
+        continue;
+      }
+      // Designators of a row are stored consecutively. With the plain
+      // panel mapping, neighboring pixels are also neighbors in the
+      // bitplanes and have the same color bits; these runs can be encoded in
+      // bulk. Anything else (multiplexing, sub-panel or chain boundaries,
+      // unused pixels) goes through the general path.
+      const int max_run = std::min(width - ix, mapper->width() - (x + ix));
+      int run = 1;
+      while (run < max_run && run < kChunk
+             && designator[run].gpio_word == designator->gpio_word + run
+             && designator[run].r_bit == designator->r_bit
+             && designator[run].g_bit == designator->g_bit
+             && designator[run].b_bit == designator->b_bit
+             && designator[run].mask == designator->mask) {
+        ++run;
+      }
+      const Color *c = colors + ix;
+      if (run < 4 || designator->gpio_word < 0) {
+        uint16_t r, g, b;
+        MapColors(c->r, c->g, c->b, &r, &g, &b);
+        SetMappedPixel(designator, r, g, b);
+        ++ix;
+        continue;
+      }
+      for (int i = 0; i < run; ++i) {
+        MapColors(c[i].r, c[i].g, c[i].b, &red[i], &green[i], &blue[i]);
+      }
+      EncodePlaneRun(red, green, blue, run, *designator, min_bit_plane,
+                     ValueAt(designator->gpio_word, min_bit_plane),
+                     columns_);
+      ix += run;
     }
   }
 }
+
 // Strange LED-mappings such as RBG or so are handled here.
 gpio_bits_t Framebuffer::GetGpioFromLedSequence(char col,
                                                 const char *led_sequence,
@@ -726,8 +1057,7 @@ gpio_bits_t Framebuffer::GetGpioFromLedSequence(char col,
 void Framebuffer::InitDefaultDesignator(int x, int y, const char *seq,
                                         PixelDesignator *d) {
   const struct HardwareMapping &h = *hardware_mapping_;
-  gpio_bits_t *bits = ValueAt(y % double_rows_, x, 0);
-  d->gpio_word = bits - bitplane_buffer_;
+  d->gpio_word = ((long)(y % double_rows_) << 16) | x;
   d->r_bit = d->g_bit = d->b_bit = 0;
   if (y < rows_) {
     if (y < double_rows_) {
@@ -802,64 +1132,219 @@ void Framebuffer::InitDefaultDesignator(int x, int y, const char *seq,
 
 void Framebuffer::Serialize(const char **data, size_t *len) const {
   *data = reinterpret_cast<const char*>(bitplane_buffer_);
-  *len = buffer_size_;
+  *len = used_buffer_size();
 }
 
 bool Framebuffer::Deserialize(const char *data, size_t len) {
-  if (len != buffer_size_) return false;
+  if (len != used_buffer_size()) return false;
+  shadow_valid_ = false;
   memcpy(bitplane_buffer_, data, len);
   return true;
 }
 
 void Framebuffer::CopyFrom(const Framebuffer *other) {
   if (other == this) return;
-  memcpy(bitplane_buffer_, other->bitplane_buffer_, buffer_size_);
+  if (other->row_stride_ != row_stride_) {
+    // Compact bitplanes with a different number of planes. The copied
+    // planes only make sense with the PWM bits they were stored for.
+    first_stored_plane_ = other->first_stored_plane_;
+    row_stride_ = other->row_stride_;
+    pwm_bits_ = other->pwm_bits_;
+  }
+  memcpy(bitplane_buffer_, other->bitplane_buffer_, used_buffer_size());
+  if (shadow_) {
+    shadow_valid_ = (other->shadow_ != NULL && other->shadow_valid_
+                     && other->shadow_width_ == shadow_width_
+                     && other->shadow_height_ == shadow_height_);
+    if (shadow_valid_) {
+      memcpy(shadow_, other->shadow_,
+             sizeof(*shadow_) * shadow_width_ * shadow_height_);
+    }
+  }
 }
 
-void Framebuffer::DumpToMatrix(GPIO *io, int pwm_low_bit) {
-  const struct HardwareMapping &h = *hardware_mapping_;
-  gpio_bits_t color_clk_mask = 0;  // Mask of bits while clocking in.
-  color_clk_mask |= h.p0_r1 | h.p0_g1 | h.p0_b1 | h.p0_r2 | h.p0_g2 | h.p0_b2;
-  if (parallel_ >= 2) {
-    color_clk_mask |= h.p1_r1 | h.p1_g1 | h.p1_b1 | h.p1_r2 | h.p1_g2 | h.p1_b2;
+void Framebuffer::CopyFrom(const Framebuffer *other,
+                           int x, int y, int width, int height) {
+  if (other == this) return;
+  if (other->row_stride_ != row_stride_) {
+    CopyFrom(other);  // Different planes stored, only all of it makes sense.
+    return;
   }
-  if (parallel_ >= 3) {
-    color_clk_mask |= h.p2_r1 | h.p2_g1 | h.p2_b1 | h.p2_r2 | h.p2_g2 | h.p2_b2;
+  PixelDesignatorMap *const mapper = *shared_mapper_;
+  const int x0 = std::max(x, 0), x1 = std::min(x + width, mapper->width());
+  const int y0 = std::max(y, 0), y1 = std::min(y + height, mapper->height());
+  if (x0 >= x1 || y0 >= y1) return;
+  const int planes = kBitPlanes - first_stored_plane_;
+  for (int iy = y0; iy < y1; ++iy) {
+    for (int ix = x0; ix < x1; ++ix) {
+      const PixelDesignator *designator = mapper->get(ix, iy);
+      const long pos = designator->gpio_word;
+      if (pos < 0) continue;
+      // Only the bits of this pixel; the others belong to other pixels
+      // clocked out in the same word.
+      const gpio_bits_t keep = designator->mask;
+      const long offset = ValueAt(pos, first_stored_plane_) - bitplane_buffer_;
+      gpio_bits_t *bits = bitplane_buffer_ + offset;
+      const gpio_bits_t *from = other->bitplane_buffer_ + offset;
+      for (int p = 0; p < planes; ++p) {
+        *bits = (*bits & keep) | (*from & ~keep);
+        bits += columns_;
+        from += columns_;
+      }
+    }
   }
-  if (parallel_ >= 4) {
-    color_clk_mask |= h.p3_r1 | h.p3_g1 | h.p3_b1 | h.p3_r2 | h.p3_g2 | h.p3_b2;
+  if (shadow_) {
+    if (other->shadow_ == NULL || !other->shadow_valid_
+        || other->shadow_width_ != shadow_width_
+        || other->shadow_height_ != shadow_height_) {
+      shadow_valid_ = false;
+    } else if (shadow_valid_) {
+      for (int iy = y0; iy < y1; ++iy) {
+        memcpy(shadow_ + iy * shadow_width_ + x0,
+               other->shadow_ + iy * shadow_width_ + x0,
+               sizeof(*shadow_) * (x1 - x0));
+      }
+    }
   }
-  if (parallel_ >= 5) {
-    color_clk_mask |= h.p4_r1 | h.p4_g1 | h.p4_b1 | h.p4_r2 | h.p4_g2 | h.p4_b2;
+}
+
+void Framebuffer::ResetShadow() {
+  if (!rgb_shadow_) return;
+  delete [] shadow_;
+  shadow_width_ = (*shared_mapper_)->width();
+  shadow_height_ = (*shared_mapper_)->height();
+  shadow_ = new Color[shadow_width_ * shadow_height_];  // Black.
+  shadow_valid_ = true;
+}
+
+bool Framebuffer::GetPixel(int x, int y,
+                           uint8_t *red, uint8_t *green, uint8_t *blue) const {
+  if (shadow_ == NULL || !shadow_valid_) return false;
+  if (x < 0 || x >= shadow_width_ || y < 0 || y >= shadow_height_) return false;
+  const Color &c = shadow_[y * shadow_width_ + x];
+  *red = c.r;
+  *green = c.g;
+  *blue = c.b;
+  return true;
+}
+
+bool Framebuffer::Reencode() {
+  if (shadow_ == NULL || !shadow_valid_) return false;
+  // Start from dark planes, so that pixels the mapper doesn't show, and
+  // planes that are not shown, don't keep old bits. Inverse colors write
+  // every shown pixel anyway.
+  if (!inverse_color_) memset(bitplane_buffer_, 0, used_buffer_size());
+  EncodePixels(0, 0, shadow_width_, shadow_height_, shadow_);
+  return true;
+}
+
+void FrameOverlay::Remove(int x, int y) {
+  for (size_t i = 0; i < pixels_.size(); ++i) {
+    if (pixels_[i].x == x && pixels_[i].y == y) {
+      pixels_.erase(pixels_.begin() + i);
+      return;
+    }
   }
-  if (parallel_ >= 6) {
-    color_clk_mask |= h.p5_r1 | h.p5_g1 | h.p5_b1 | h.p5_r2 | h.p5_g2 | h.p5_b2;
+}
+
+void Framebuffer::SetOverlayPixel(FrameOverlay *overlay, int x, int y,
+                                  uint8_t r, uint8_t g, uint8_t b) {
+  overlay->Remove(x, y);
+  const PixelDesignator *designator = (*shared_mapper_)->get(x, y);
+  if (designator == NULL || designator->gpio_word < 0) return;
+
+  FrameOverlay::Pixel pixel;
+  pixel.x = x; pixel.y = y;
+  pixel.r = r; pixel.g = g; pixel.b = b;
+  pixel.double_row = designator->gpio_word >> 16;
+  pixel.column = designator->gpio_word & 0xffff;
+  pixel.r_bit = designator->r_bit;
+  pixel.g_bit = designator->g_bit;
+  pixel.b_bit = designator->b_bit;
+  pixel.mask = designator->mask;
+  MapColors(r, g, b, &pixel.red, &pixel.green, &pixel.blue);
+
+  std::vector<FrameOverlay::Pixel> &pixels = overlay->pixels_;
+  pixels.insert(std::upper_bound(pixels.begin(), pixels.end(), pixel,
+                                 FrameOverlay::RowLess),
+                pixel);
+  overlay->merged_row_.resize(columns_);
+}
+
+void Framebuffer::RemapOverlay(FrameOverlay *overlay) {
+  const std::vector<FrameOverlay::Pixel> pixels = overlay->pixels_;
+  overlay->Clear();
+  for (size_t i = 0; i < pixels.size(); ++i) {
+    const FrameOverlay::Pixel &p = pixels[i];
+    SetOverlayPixel(overlay, p.x, p.y, p.r, p.g, p.b);
   }
+}
 
-  color_clk_mask |= h.clock;
+void Framebuffer::DumpToMatrix(GPIO *io, int pwm_low_bit,
+                               FrameOverlay *overlay) {
+  // Framebuffers created before InitGPIO() don't know the row setter yet.
+  if (dump_kernel_ == NULL) dump_kernel_ = SelectDumpKernel(scan_mode_);
+  if (overlay != NULL && overlay->empty()) overlay = NULL;
+  (this->*dump_kernel_)(io, pwm_low_bit, overlay);
+}
+
+template <bool kInterlaced, class RowSetter>
+void Framebuffer::DumpToMatrixKernel(GPIO *io, int pwm_low_bit,
+                                     FrameOverlay *overlay) {
+  const struct HardwareMapping &h = *hardware_mapping_;
+  const gpio_bits_t color_clk_mask = color_clk_mask_;  // While clocking in.
+  RowSetter *const row_setter = static_cast<RowSetter*>(row_setter_);
+
+  // The layout of a shown buffer does not change; see SetPWMBitsKeepLayout().
+  const int first_plane = first_stored_plane_;
+  const size_t row_stride = row_stride_;
 
   // Depending if we do dithering, we might not always show the lowest bits.
-  const int start_bit = std::max(pwm_low_bit, kBitPlanes - pwm_bits_);
+  const int start_bit = std::max(std::max(pwm_low_bit, kBitPlanes - pwm_bits_),
+                                 first_plane);
 
   const uint8_t half_double = double_rows_/2;
   for (uint8_t row_loop = 0; row_loop < double_rows_; ++row_loop) {
-    uint8_t d_row;
-    switch (scan_mode_) {
-    case 0:  // progressive
-    default:
-      d_row = row_loop;
-      break;
-
-    case 1:  // interlaced
-      d_row = ((row_loop < half_double)
-               ? (row_loop << 1)
-               : ((row_loop - half_double) << 1) + 1);
+    const uint8_t d_row = (!kInterlaced
+                           ? row_loop
+                           : ((row_loop < half_double)
+                              ? (row_loop << 1)
+                              : ((row_loop - half_double) << 1) + 1));
+
+    // Overlay pixels in this row, if any.
+    const FrameOverlay::Pixel *overlay_begin = NULL, *overlay_end = NULL;
+    if (overlay) {
+      FrameOverlay::Pixel key;
+      key.double_row = d_row;
+      const FrameOverlay::Pixel *const pixels = overlay->pixels_.data();
+      const FrameOverlay::Pixel *const end = pixels + overlay->pixels_.size();
+      overlay_begin = std::lower_bound(pixels, end, key, FrameOverlay::RowLess);
+      overlay_end = std::upper_bound(overlay_begin, end, key,
+                                     FrameOverlay::RowLess);
     }
 
     // Rows can't be switched very quickly without ghosting, so we do the
     // full PWM of one row before switching rows.
     for (int b = start_bit; b < kBitPlanes; ++b) {
-      gpio_bits_t *row_data = ValueAt(d_row, 0, b);
+      const size_t offset = d_row * row_stride + (b - first_plane) * columns_;
+      const gpio_bits_t *row_data = bitplane_buffer_ + offset;
+      if (overlay_begin != overlay_end) {
+        // Clock out a copy with the overlay pixels merged in, in the same
+        // form as the frame.
+        gpio_bits_t *merged = &overlay->merged_row_[0];
+        memcpy(merged, row_data, sizeof(*merged) * columns_);
+        const uint16_t mask = 1 << b;
+        for (const FrameOverlay::Pixel *p = overlay_begin; p != overlay_end;
+             ++p) {
+          gpio_bits_t color_bits = 0;
+          if (p->red & mask)   color_bits |= p->r_bit;
+          if (p->green & mask) color_bits |= p->g_bit;
+          if (p->blue & mask)  color_bits |= p->b_bit;
+          gpio_bits_t &word = merged[p->column];
+          word = (word & p->mask) | color_bits;
+        }
+        row_data = merged;
+      }
       // While the output enable is still on, we can already clock in the next
       // data.
       for (int col = 0; col < columns_; ++col) {
@@ -873,7 +1358,8 @@ void Framebuffer::DumpToMatrix(GPIO *io, int pwm_low_bit) {
       sOutputEnablePulser->WaitPulseFinished();
 
       // Setting address and strobing needs to happen in dark time.
-      row_setter_->SetRowAddress(io, d_row);
+      // Qualified call: no virtual dispatch, can be inlined.
+      row_setter->RowSetter::SetRowAddress(io, d_row);
 
       io->SetBits(h.strobe);   // Strobe in the previously clocked in row.
       io->ClearBits(h.strobe);
@@ -883,5 +1369,26 @@ void Framebuffer::DumpToMatrix(GPIO *io, int pwm_low_bit) {
     }
   }
 }
+
+/* static */ Framebuffer::DumpKernel
+Framebuffer::SelectDumpKernel(int scan_mode) {
+  // Must match the row setters created in InitGPIO(). Scan modes other
+  // than 1 are progressive.
+#define DUMP_KERNELS(RowSetter)                                         \
+  (scan_mode == 1                                                       \
+   ? &Framebuffer::DumpToMatrixKernel<true, RowSetter>                  \
+   : &Framebuffer::DumpToMatrixKernel<false, RowSetter>)
+  switch (row_address_type_) {
+  case 0:  return DUMP_KERNELS(DirectRowAddressSetter);
+  case 1:  return DUMP_KERNELS(ShiftRegisterRowAddressSetter);
+  case 2:  return DUMP_KERNELS(DirectABCDLineRowAddressSetter);
+  case 3:  return DUMP_KERNELS(ABCShiftRegisterRowAddressSetter);
+  case 4:  return DUMP_KERNELS(SM5266RowAddressSetter);
+  default:
+    assert(0);  // unexpected type.
+    return NULL;
+  }
+#undef DUMP_KERNELS
+}
 }  // namespace internal
 }  // namespace rgb_matrix
@@ -19,6 +19,7 @@
 #include <stdlib.h>
 #include <functional>
 #include <algorithm>
+#include <vector>
 
 namespace rgb_matrix {
 bool SetImage(Canvas *c, int canvas_offset_x, int canvas_offset_y,
@@ -57,26 +58,34 @@ bool SetImage(Canvas *c, int canvas_offset_x, int canvas_offset_y,
   const size_t next_row_skip = skip_start_row + skip_end_row;
   buffer += skip_start_row;
 
-  if (is_bgr) {
-    for (int y = canvas_offset_y; y < h; ++y) {
-      for (int x = canvas_offset_x; x < w; ++x) {
-        c->SetPixel(x, y, buffer[2], buffer[1], buffer[0]);
-        buffer += 3;
-      }
-      buffer += next_row_skip;
-    }
-  } else {
-    for (int y = canvas_offset_y; y < h; ++y) {
-      for (int x = canvas_offset_x; x < w; ++x) {
-        c->SetPixel(x, y, buffer[0], buffer[1], buffer[2]);
-        buffer += 3;
-      }
-      buffer += next_row_skip;
+  // Hand over full rows, so that canvases can convert them in bulk.
+  const int row_width = w - canvas_offset_x;
+  if (row_width <= 0) return true;
+  std::vector<Color> row(row_width);
+  const int r = is_bgr ? 2 : 0;
+  const int b = is_bgr ? 0 : 2;
+  for (int y = canvas_offset_y; y < h; ++y) {
+    for (int x = 0; x < row_width; ++x) {
+      row[x].r = buffer[r];
+      row[x].g = buffer[1];
+      row[x].b = buffer[b];
+      buffer += 3;
     }
+    c->SetPixels(canvas_offset_x, y, row_width, 1, row.data());
+    buffer += next_row_skip;
   }
   return true;
 }
 
+void Canvas::SetPixels(int x, int y, int width, int height, Color *colors) {
+  for (int iy = 0; iy < height; ++iy) {
+    for (int ix = 0; ix < width; ++ix) {
+      SetPixel(x + ix, y + iy, colors->r, colors->g, colors->b);
+      ++colors;
+    }
+  }
+}
+
 int DrawText(Canvas *c, const Font &font,
              int x, int y, const Color &color,
              const char *utf8_text) {
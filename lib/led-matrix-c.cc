@@ -89,6 +89,9 @@ static struct RGBLedMatrix *led_matrix_create_from_options_optional_edit(
     OPT_COPY_IF_SET(panel_type);
     OPT_COPY_IF_SET(limit_refresh_rate_hz);
     OPT_COPY_IF_SET(disable_busy_waiting);
+    OPT_COPY_IF_SET(compact_bitplanes);
+    OPT_COPY_IF_SET(rgb_shadow);
+    OPT_COPY_IF_SET(pwm_auto_tune_hz);
 #undef OPT_COPY_IF_SET
   }
 
@@ -136,6 +139,9 @@ static struct RGBLedMatrix *led_matrix_create_from_options_optional_edit(
     ACTUAL_VALUE_BACK_TO_OPT(panel_type);
     ACTUAL_VALUE_BACK_TO_OPT(limit_refresh_rate_hz);
     ACTUAL_VALUE_BACK_TO_OPT(disable_busy_waiting);
+    ACTUAL_VALUE_BACK_TO_OPT(compact_bitplanes);
+    ACTUAL_VALUE_BACK_TO_OPT(rgb_shadow);
+    ACTUAL_VALUE_BACK_TO_OPT(pwm_auto_tune_hz);
 #undef ACTUAL_VALUE_BACK_TO_OPT
   }
 
@@ -207,6 +213,11 @@ struct LedCanvas *led_matrix_swap_on_vsync(struct RGBLedMatrix *matrix,
   return from_canvas(to_matrix(matrix)->SwapOnVSync(to_canvas(canvas)));
 }
 
+struct LedCanvas *led_matrix_try_swap_on_vsync(struct RGBLedMatrix *matrix,
+                                               struct LedCanvas *canvas) {
+  return from_canvas(to_matrix(matrix)->TrySwapOnVSync(to_canvas(canvas)));
+}
+
 void led_matrix_set_brightness(struct RGBLedMatrix *matrix,
                                uint8_t brightness) {
   to_matrix(matrix)->SetBrightness(brightness);
@@ -216,6 +227,31 @@ uint8_t led_matrix_get_brightness(struct RGBLedMatrix *matrix) {
   return to_matrix(matrix)->brightness();
 }
 
+int led_matrix_get_refresh_rate_limit(struct RGBLedMatrix *matrix) {
+  return to_matrix(matrix)->refresh_rate_limit();
+}
+
+void led_matrix_set_refresh_rate_limit(struct RGBLedMatrix *matrix, int hz) {
+  to_matrix(matrix)->SetRefreshRateLimit(hz);
+}
+
+void led_matrix_set_busy_waiting(struct RGBLedMatrix *matrix, bool allow) {
+  to_matrix(matrix)->SetBusyWaiting(allow);
+}
+
+void led_matrix_set_overlay_pixel(struct RGBLedMatrix *matrix, int x, int y,
+                                  uint8_t r, uint8_t g, uint8_t b) {
+  to_matrix(matrix)->SetOverlayPixel(x, y, r, g, b);
+}
+
+void led_matrix_clear_overlay_pixel(struct RGBLedMatrix *matrix, int x, int y) {
+  to_matrix(matrix)->ClearOverlayPixel(x, y);
+}
+
+void led_matrix_clear_overlay(struct RGBLedMatrix *matrix) {
+  to_matrix(matrix)->ClearOverlay();
+}
+
 void led_canvas_get_size(const struct LedCanvas *canvas,
                          int *width, int *height) {
   rgb_matrix::FrameCanvas *c = to_canvas((struct LedCanvas*)canvas);
@@ -242,6 +278,15 @@ void led_canvas_fill(struct LedCanvas *canvas, uint8_t r, uint8_t g, uint8_t b)
   to_canvas(canvas)->Fill(r, g, b);
 }
 
+bool led_canvas_get_pixel(const struct LedCanvas *canvas, int x, int y,
+                          uint8_t *r, uint8_t *g, uint8_t *b) {
+  return to_canvas((struct LedCanvas*)canvas)->GetPixel(x, y, r, g, b);
+}
+
+bool led_canvas_reencode(struct LedCanvas *canvas) {
+  return to_canvas(canvas)->Reencode();
+}
+
 struct LedFont *load_font(const char *bdf_font_file) {
   rgb_matrix::Font* font = new rgb_matrix::Font();
   font->LoadFont(bdf_font_file);
@@ -29,10 +29,13 @@
 #include <time.h>
 #include <unistd.h>
 
+#include <atomic>
+
 #include "gpio.h"
 #include "thread.h"
 #include "framebuffer-internal.h"
 #include "multiplex-mappers-internal.h"
+#include "pwm-auto-tuner.h"
 
 // Leave this in here for a while. Setting things from old defines.
 #if defined(ADAFRUIT_RGBMATRIX_HAT)
@@ -74,6 +77,7 @@ public:
 
   FrameCanvas *CreateFrameCanvas();
   FrameCanvas *SwapOnVSync(FrameCanvas *other, unsigned framerate_fraction);
+  FrameCanvas *TrySwapOnVSync(FrameCanvas *other, unsigned framerate_fraction);
   bool ApplyPixelMapper(const PixelMapper *mapper);
 
   bool SetPWMBits(uint8_t value);
@@ -87,9 +91,22 @@ public:
   void SetBrightness(uint8_t brightness);
   uint8_t brightness();
 
+  void SetRefreshRateLimit(int limit_refresh_rate_hz);
+  int refresh_rate_limit() const { return params_.limit_refresh_rate_hz; }
+  void SetBusyWaiting(bool allow_busy_waiting);
+  bool busy_waiting() const { return !params_.disable_busy_waiting; }
+
   uint64_t RequestInputs(uint64_t);
   uint64_t AwaitInputChange(int timeout_ms);
 
+  bool GetRefreshStats(RefreshStats *stats);
+  void ResetRefreshStats();
+  bool GetFrameClock(uint64_t *frame_count, float *frame_usec);
+
+  void SetOverlayPixel(int x, int y, uint8_t red, uint8_t green, uint8_t blue);
+  void ClearOverlayPixel(int x, int y);
+  void ClearOverlay();
+
   uint64_t RequestOutputs(uint64_t output_bits);
   void OutputGPIO(uint64_t output_bits);
 
@@ -101,6 +118,9 @@ private:
   void ApplyNamedPixelMappers(const char *pixel_mapper_config,
                               int chain, int parallel);
 
+  // Hand a copy of overlay_ to the refresh thread.
+  void PublishOverlay();
+
   Options params_;
   bool do_luminance_correct_;
 
@@ -112,6 +132,7 @@ private:
   std::vector<FrameCanvas*> created_frames_;
   internal::PixelDesignatorMap *shared_pixel_mapper_;
   uint64_t user_output_bits_;
+  internal::FrameOverlay overlay_;  // The refresh thread shows a copy.
 };
 
 using namespace internal;
@@ -121,13 +142,21 @@ class RGBMatrix::Impl::UpdateThread : public Thread {
 public:
   UpdateThread(GPIO *io, FrameCanvas *initial_frame,
                int pwm_dither_bits, bool show_refresh,
-               int limit_refresh_hz, bool allow_busy_waiting)
+               int limit_refresh_hz, bool allow_busy_waiting,
+               PwmAutoTuner *auto_tuner)
     : io_(io), show_refresh_(show_refresh),
-      target_frame_usec_(limit_refresh_hz < 1 ? 0 : 1e6/limit_refresh_hz),
+      target_frame_usec_(FrameUsecForLimit(limit_refresh_hz)),
       allow_busy_waiting_(allow_busy_waiting),
+      auto_tuner_(auto_tuner),
       running_(true),
-      current_frame_(initial_frame), next_frame_(NULL),
-      requested_frame_multiple_(1) {
+      swap_waiters_(0), vsync_count_(0),
+      swap_waits_(0), total_swap_wait_usec_(0), max_swap_wait_usec_(0),
+      current_frame_(initial_frame), exchange_frame_(0),
+      requested_frame_multiple_(1),
+      stats_sequence_(0), reset_stats_(false),
+      frame_count_(0), frame_usec_(0),
+      published_frame_count_(0), published_frame_usec_(0),
+      clock_sequence_(0), overlay_(NULL), overlay_update_(NULL) {
     pthread_cond_init(&frame_done_, NULL);
     pthread_cond_init(&input_change_, NULL);
     switch (pwm_dither_bits) {
@@ -146,6 +175,18 @@ public:
     }
   }
 
+  virtual ~UpdateThread() {
+    delete auto_tuner_;
+    delete overlay_;
+    delete overlay_update_.load();
+  }
+
+  // Show "overlay" (taking ownership) from the next frame on. One that was
+  // not picked up yet is replaced.
+  void SetOverlay(FrameOverlay *overlay) {
+    delete overlay_update_.exchange(overlay);
+  }
+
   void Stop() {
     MutexLock l(&running_mutex_);
     running_ = false;
@@ -154,7 +195,6 @@ public:
   virtual void Run() {
     unsigned frame_count = 0;
     unsigned low_bit_sequence = 0;
-    uint32_t largest_time = 0;
     gpio_bits_t last_gpio_bits = 0;
 
     // Let's start measure max time only after a we were running for a few
@@ -166,23 +206,58 @@ public:
     while (running()) {
       const uint32_t start_time_us = GetMicrosecondCounter();
 
-      current_frame_->framebuffer()
-        ->DumpToMatrix(io_, start_bit_[low_bit_sequence % 4]);
-
-      // SwapOnVSync() exchange.
-      {
-        MutexLock l(&frame_sync_);
-        // Do fast equality test first (likely due to frame_count reset).
-        if (frame_count == requested_frame_multiple_
-            || frame_count % requested_frame_multiple_ == 0) {
-          // We reset to avoid frame hick-up every couple of weeks
-          // run-time iff requested_frame_multiple_ is not a factor of 2^32.
-          frame_count = 0;
-          if (next_frame_ != NULL) {
-            current_frame_ = next_frame_;
-            next_frame_ = NULL;
-          }
-          pthread_cond_signal(&frame_done_);
+      if (reset_stats_.load(std::memory_order_relaxed)
+          && reset_stats_.exchange(false)) {
+        stats_ = RefreshStats();
+      }
+
+      Framebuffer *const frame =
+        current_frame_.load(std::memory_order_relaxed)->framebuffer();
+      int low_bit = start_bit_[low_bit_sequence % 4];
+      if (auto_tuner_) {
+        // Showing fewer bits is the same as SetPWMBits(), but leaves the
+        // user's frames alone.
+        const int tuned_low_bit =
+          Framebuffer::kBitPlanes - auto_tuner_->pwm_bits();
+        if (tuned_low_bit > low_bit) low_bit = tuned_low_bit;
+      }
+      if (overlay_update_.load(std::memory_order_relaxed) != NULL) {
+        delete overlay_;
+        overlay_ = overlay_update_.exchange(NULL);
+      }
+      frame->DumpToMatrix(io_, low_bit, overlay_);
+      if (auto_tuner_) {
+        const int frame_low_bit = Framebuffer::kBitPlanes - frame->pwmbits();
+        auto_tuner_->Observe(low_bit > frame_low_bit ? low_bit : frame_low_bit,
+                             GetMicrosecondCounter() - start_time_us);
+        stats_.auto_pwm_bits = auto_tuner_->pwm_bits();
+      }
+
+      // Before a swap, so whoever returns from SwapOnVSync() sees this frame.
+      ++frame_count_;
+      PublishFrameClock();
+
+      // SwapOnVSync() exchange. Lock-free; we only take the mutex to wake
+      // up a blocking SwapOnVSync() if there is one.
+      const unsigned frame_multiple =
+        requested_frame_multiple_.load(std::memory_order_relaxed);
+      // Do fast equality test first (likely due to frame_count reset).
+      if (frame_count == frame_multiple || frame_count % frame_multiple == 0) {
+        // We reset to avoid frame hick-up every couple of weeks
+        // run-time iff requested_frame_multiple_ is not a factor of 2^32.
+        frame_count = 0;
+        if (exchange_frame_.load() & kFreshFrame) {
+          // Show the fresh frame, leave the one we showed for the producer.
+          const uintptr_t shown =
+            reinterpret_cast<uintptr_t>(current_frame_.load());
+          const uintptr_t next = exchange_frame_.exchange(shown);
+          current_frame_.store(reinterpret_cast<FrameCanvas*>(next & ~kFreshFrame));
+          ++stats_.swaps;
+        }
+        vsync_count_.fetch_add(1);
+        if (swap_waiters_.load() > 0) {
+          MutexLock l(&frame_sync_);
+          pthread_cond_broadcast(&frame_done_);
         }
       }
 
@@ -198,29 +273,49 @@ public:
       ++frame_count;
       ++low_bit_sequence;
 
-      if (target_frame_usec_) {
-        if (allow_busy_waiting_) {
-          while ((GetMicrosecondCounter() - start_time_us) < target_frame_usec_) {
+      // Both can be changed at any time from other threads.
+      const uint32_t target_frame_usec =
+        target_frame_usec_.load(std::memory_order_relaxed);
+      bool waited = false;
+      if (target_frame_usec) {
+        const uint32_t spent_us = GetMicrosecondCounter() - start_time_us;
+        if (spent_us > target_frame_usec) {
+          ++stats_.missed_deadlines;
+        } else {
+          waited = true;
+        }
+        if (allow_busy_waiting_.load(std::memory_order_relaxed)) {
+          while ((GetMicrosecondCounter() - start_time_us) < target_frame_usec) {
             // busy wait. We have our dedicated core, so ok to burn cycles.
           }
         } else {
           long spent_us = GetMicrosecondCounter() - start_time_us;
-          SleepMicroseconds(target_frame_usec_ - spent_us);
+          SleepMicroseconds(target_frame_usec - spent_us);
         }
       }
 
       const uint32_t end_time_us = GetMicrosecondCounter();
+      const uint32_t usec = end_time_us - start_time_us;
+      if (!max_measure_enabled) {
+        // Don't measure at startup, as times will be janky.
+        max_measure_enabled = (end_time_us - initial_holdoff_start) > kHoldffTimeUs;
+      }
+      const uint32_t previous_max_usec = stats_.max_frame_usec;
+      RecordFrame(usec, max_measure_enabled);
+      // Smooth out jitter; published with the next frame.
+      frame_usec_ = (frame_usec_ == 0 ? usec : frame_usec_ + (usec - frame_usec_) / 32);
+      if (waited) {
+        const uint32_t overshoot_us = (usec > target_frame_usec
+                                       ? usec - target_frame_usec : 0);
+        ++stats_.overshoot_usec_histogram[HistogramBucket(overshoot_us)];
+      }
+      PublishStats();
+
       if (show_refresh_) {
-        uint32_t usec = end_time_us - start_time_us;
         printf("\b\b\b\b\b\b\b\b%6.1fHz", 1e6 / usec);
-        if (usec > largest_time && max_measure_enabled) {
-          largest_time = usec;
-          const float lowest_hz = 1e6 / largest_time;
+        if (stats_.max_frame_usec > previous_max_usec) {
           printf(" (lowest: %.1fHz)"
-                 "\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b", lowest_hz);
-        } else {
-          // Don't measure at startup, as times will be janky.
-          max_measure_enabled = (end_time_us - initial_holdoff_start) > kHoldffTimeUs;
+                 "\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b", stats_.min_hz());
         }
       }
     }
@@ -228,11 +323,76 @@ public:
 
   FrameCanvas *SwapOnVSync(FrameCanvas *other, unsigned frame_fraction) {
     MutexLock l(&frame_sync_);
-    FrameCanvas *previous = current_frame_;
-    next_frame_ = other;
-    requested_frame_multiple_ = frame_fraction;
-    frame_sync_.WaitOn(&frame_done_);
-    return previous;
+    const uint32_t start_us = GetMicrosecondCounter();
+    ++swap_waiters_;
+    requested_frame_multiple_.store(frame_fraction);
+    if (other == NULL) {
+      // Just wait for the next vsync.
+      const unsigned vsync = vsync_count_.load();
+      while (vsync_count_.load() == vsync) frame_sync_.WaitOn(&frame_done_);
+      --swap_waiters_;
+      RecordSwapWait(GetMicrosecondCounter() - start_us);
+      return current_frame_.load();
+    }
+    const uintptr_t fresh = reinterpret_cast<uintptr_t>(other) | kFreshFrame;
+    // A frame left by TrySwapOnVSync(), queued or free, is not shown anymore
+    // once ours is; it goes back in the exchange for the next
+    // TrySwapOnVSync() to return.
+    uintptr_t displaced = ExchangeFreeFrame(fresh);
+    if (displaced == reinterpret_cast<uintptr_t>(other)) displaced = 0;
+    while (exchange_frame_.load() == fresh) frame_sync_.WaitOn(&frame_done_);
+    --swap_waiters_;
+    RecordSwapWait(GetMicrosecondCounter() - start_us);
+    // Now the frame that was replaced on screen; take it out of the exchange.
+    return reinterpret_cast<FrameCanvas*>(ExchangeFreeFrame(displaced));
+  }
+
+  FrameCanvas *TrySwapOnVSync(FrameCanvas *other, unsigned frame_fraction) {
+    requested_frame_multiple_.store(frame_fraction);
+    return reinterpret_cast<FrameCanvas*>(
+      ExchangeFreeFrame(reinterpret_cast<uintptr_t>(other) | kFreshFrame));
+  }
+
+  void SetRefreshRateLimit(int limit_refresh_hz) {
+    target_frame_usec_.store(FrameUsecForLimit(limit_refresh_hz));
+  }
+
+  void SetBusyWaiting(bool allow_busy_waiting) {
+    allow_busy_waiting_.store(allow_busy_waiting);
+  }
+
+  void GetStats(RefreshStats *out) {
+    // Seqlock: retry if the refresh thread published while we were copying.
+    for (;;) {
+      const unsigned sequence = stats_sequence_.load(std::memory_order_acquire);
+      if (sequence & 1) continue;
+      *out = published_stats_;
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (stats_sequence_.load(std::memory_order_relaxed) == sequence) break;
+    }
+    MutexLock l(&frame_sync_);
+    out->swap_waits = swap_waits_;
+    out->total_swap_wait_usec = total_swap_wait_usec_;
+    out->max_swap_wait_usec = max_swap_wait_usec_;
+  }
+
+  void GetFrameClock(uint64_t *frame_count, float *frame_usec) {
+    for (;;) {  // Seqlock, as in GetStats().
+      const unsigned sequence = clock_sequence_.load(std::memory_order_acquire);
+      if (sequence & 1) continue;
+      *frame_count = published_frame_count_;
+      *frame_usec = published_frame_usec_;
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (clock_sequence_.load(std::memory_order_relaxed) == sequence) break;
+    }
+  }
+
+  void ResetStats() {
+    reset_stats_.store(true);
+    MutexLock l(&frame_sync_);
+    swap_waits_ = 0;
+    total_swap_wait_usec_ = 0;
+    max_swap_wait_usec_ = 0;
   }
 
   gpio_bits_t AwaitInputChange(int timeout_ms) {
@@ -247,11 +407,71 @@ private:
     return running_;
   }
 
+  static int HistogramBucket(uint32_t usec) {
+    if (usec == 0) return 0;
+    const int bucket = 32 - __builtin_clz(usec);
+    return (bucket < RefreshStats::kHistogramBuckets
+            ? bucket : RefreshStats::kHistogramBuckets - 1);
+  }
+
+  void RecordFrame(uint32_t usec, bool with_min_max) {
+    ++stats_.frames;
+    stats_.total_frame_usec += usec;
+    stats_.last_frame_usec = usec;
+    if (with_min_max) {
+      if (stats_.min_frame_usec == 0 || usec < stats_.min_frame_usec)
+        stats_.min_frame_usec = usec;
+      if (usec > stats_.max_frame_usec)
+        stats_.max_frame_usec = usec;
+    }
+    ++stats_.frame_usec_histogram[HistogramBucket(usec)];
+  }
+
+  // Publish a copy of stats_ for GetStats(). We are the only writer.
+  void PublishStats() {
+    const unsigned sequence = stats_sequence_.load(std::memory_order_relaxed);
+    stats_sequence_.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    published_stats_ = stats_;
+    stats_sequence_.store(sequence + 2, std::memory_order_release);
+  }
+
+  void PublishFrameClock() {
+    const unsigned sequence = clock_sequence_.load(std::memory_order_relaxed);
+    clock_sequence_.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    published_frame_count_ = frame_count_;
+    published_frame_usec_ = frame_usec_;
+    clock_sequence_.store(sequence + 2, std::memory_order_release);
+  }
+
+  // Called with frame_sync_ held.
+  void RecordSwapWait(uint32_t usec) {
+    ++swap_waits_;
+    total_swap_wait_usec_ += usec;
+    if (usec > max_swap_wait_usec_) max_swap_wait_usec_ = usec;
+  }
+
+  static uint32_t FrameUsecForLimit(int limit_refresh_hz) {
+    return limit_refresh_hz < 1 ? 0 : 1e6/limit_refresh_hz;
+  }
+
+  // Put "value" in the exchange slot and return the canvas that was there,
+  // which is not shown and not queued to be shown anymore.
+  inline uintptr_t ExchangeFreeFrame(uintptr_t value) {
+    return exchange_frame_.exchange(value) & ~kFreshFrame;
+  }
+
+  // Flag in exchange_frame_: the frame was handed over, but is not shown yet.
+  // Otherwise, the frame in there was shown before and is free to be drawn on.
+  static const uintptr_t kFreshFrame = 1;
+
   GPIO *const io_;
   const bool show_refresh_;
-  const uint32_t target_frame_usec_;
-  const bool allow_busy_waiting_;
+  std::atomic<uint32_t> target_frame_usec_;
+  std::atomic<bool> allow_busy_waiting_;
   uint32_t start_bit_[4];
+  PwmAutoTuner *const auto_tuner_;  // Owned; NULL if not auto-tuning.
 
   Mutex running_mutex_;
   bool running_;
@@ -260,13 +480,54 @@ private:
   pthread_cond_t input_change_;
   gpio_bits_t gpio_inputs_;
 
+  // Blocking SwapOnVSync() waits on frame_done_; the refresh thread only
+  // signals it if there are waiters.
   Mutex frame_sync_;
   pthread_cond_t frame_done_;
-  FrameCanvas *current_frame_;
-  FrameCanvas *next_frame_;
-  unsigned requested_frame_multiple_;
+  std::atomic<int> swap_waiters_;
+  std::atomic<unsigned> vsync_count_;
+  uint64_t swap_waits_;             // Swap wait statistics, guarded by
+  uint64_t total_swap_wait_usec_;   // frame_sync_.
+  uint32_t max_swap_wait_usec_;
+
+  // Triple buffering: the refresh thread owns current_frame_, the producer
+  // the frame it draws on, and exchange_frame_ passes frames between them.
+  std::atomic<FrameCanvas*> current_frame_;
+  std::atomic<uintptr_t> exchange_frame_;
+  std::atomic<unsigned> requested_frame_multiple_;
+
+  RefreshStats stats_;              // Only used by the refresh thread.
+  RefreshStats published_stats_;    // Copy for other threads.
+  std::atomic<unsigned> stats_sequence_;  // Odd while publishing.
+  std::atomic<bool> reset_stats_;
+
+  // Frame clock. Not part of the stats, as it never resets.
+  uint64_t frame_count_;            // Only used by the refresh thread.
+  float frame_usec_;
+  uint64_t published_frame_count_;  // Copies for other threads.
+  float published_frame_usec_;
+  std::atomic<unsigned> clock_sequence_;  // Odd while publishing.
+
+  // Overlay shown on every frame. SetOverlay() only touches overlay_update_,
+  // which the refresh thread takes over from.
+  FrameOverlay *overlay_;           // Only used by the refresh thread.
+  std::atomic<FrameOverlay*> overlay_update_;
 };
 
+RGBMatrix::RefreshStats::RefreshStats() {
+  memset(this, 0, sizeof(*this));
+}
+
+double RGBMatrix::RefreshStats::mean_hz() const {
+  return total_frame_usec ? 1e6 * frames / total_frame_usec : 0;
+}
+double RGBMatrix::RefreshStats::min_hz() const {
+  return max_frame_usec ? 1e6 / max_frame_usec : 0;
+}
+double RGBMatrix::RefreshStats::max_hz() const {
+  return min_frame_usec ? 1e6 / min_frame_usec : 0;
+}
+
 // Some defaults. See options-initialize.cc for the command line parsing.
 RGBMatrix::Options::Options() :
   // Historically, we provided these options only as #defines. Make sure that
@@ -325,10 +586,13 @@ RGBMatrix::Options::Options() :
   limit_refresh_rate_hz(0),
 #endif
 #ifdef DISABLE_BUSY_WAITING
-    disable_busy_waiting(true)
+    disable_busy_waiting(true),
 #else
-    disable_busy_waiting(false)
+    disable_busy_waiting(false),
 #endif
+  compact_bitplanes(false),
+  rgb_shadow(false),
+  pwm_auto_tune_hz(0)
 {
   // Nothing to see here.
 }
@@ -360,6 +624,9 @@ static void PrintOptions(const RGBMatrix::Options &o) {
   P_STR(panel_type);
   P_INT(limit_refresh_rate_hz);
   P_BOOL(disable_busy_waiting);
+  P_BOOL(compact_bitplanes);
+  P_BOOL(rgb_shadow);
+  P_INT(pwm_auto_tune_hz);
 #undef P_INT
 #undef P_STR
 #undef P_BOOL
@@ -482,7 +749,16 @@ bool RGBMatrix::Impl::StartRefresh() {
     updater_ = new UpdateThread(io_, active_, params_.pwm_dither_bits,
                                 params_.show_refresh_rate,
                                 params_.limit_refresh_rate_hz,
-                                !params_.disable_busy_waiting);
+                                !params_.disable_busy_waiting,
+                                params_.pwm_auto_tune_hz > 0
+                                ? new PwmAutoTuner(
+                                  active_->framebuffer()->double_rows(),
+                                  params_.pwm_lsb_nanoseconds,
+                                  params_.pwm_dither_bits,
+                                  params_.pwm_bits,
+                                  params_.pwm_auto_tune_hz)
+                                : NULL);
+    if (!overlay_.empty()) PublishOverlay();
     // If we have multiple processors, the kernel
     // jumps around between these, creating some global flicker.
     // So let's tie it to the last CPU available.
@@ -503,6 +779,8 @@ FrameCanvas *RGBMatrix::Impl::CreateFrameCanvas() {
                                     params_.scan_mode,
                                     params_.led_rgb_sequence,
                                     params_.inverse_colors,
+                                    params_.compact_bitplanes,
+                                    params_.rgb_shadow,
                                     &shared_pixel_mapper_));
   if (created_frames_.empty()) {
     // First time. Get defaults from initial Framebuffer.
@@ -536,17 +814,71 @@ FrameCanvas *RGBMatrix::Impl::SwapOnVSync(FrameCanvas *other,
   if (frame_fraction == 0) frame_fraction = 1; // correct user error.
   if (!updater_) return NULL;
   FrameCanvas *const previous = updater_->SwapOnVSync(other, frame_fraction);
-  if (other) active_ = other;
+  if (other) {
+    active_ = other;
+    // Not shown anymore; see SetPWMBits().
+    if (previous) previous->framebuffer()->ApplyPWMBitsLayout();
+  }
   return previous;
 }
 
+FrameCanvas *RGBMatrix::Impl::TrySwapOnVSync(FrameCanvas *other,
+                                             unsigned frame_fraction) {
+  if (frame_fraction == 0) frame_fraction = 1; // correct user error.
+  if (!updater_ || !other) return NULL;
+  FrameCanvas *const free_frame = updater_->TrySwapOnVSync(other,
+                                                           frame_fraction);
+  active_ = other;
+  if (free_frame) free_frame->framebuffer()->ApplyPWMBitsLayout();
+  return free_frame;
+}
+
+bool RGBMatrix::Impl::GetRefreshStats(RefreshStats *stats) {
+  if (!updater_) return false;
+  updater_->GetStats(stats);
+  return true;
+}
+
+void RGBMatrix::Impl::ResetRefreshStats() {
+  if (updater_) updater_->ResetStats();
+}
+
+bool RGBMatrix::Impl::GetFrameClock(uint64_t *frame_count, float *frame_usec) {
+  if (!updater_) return false;
+  updater_->GetFrameClock(frame_count, frame_usec);
+  return true;
+}
+
+void RGBMatrix::Impl::SetOverlayPixel(int x, int y,
+                                      uint8_t red, uint8_t green, uint8_t blue) {
+  active_->framebuffer()->SetOverlayPixel(&overlay_, x, y, red, green, blue);
+  PublishOverlay();
+}
+
+void RGBMatrix::Impl::ClearOverlayPixel(int x, int y) {
+  overlay_.Remove(x, y);
+  PublishOverlay();
+}
+
+void RGBMatrix::Impl::ClearOverlay() {
+  overlay_.Clear();
+  PublishOverlay();
+}
+
+void RGBMatrix::Impl::PublishOverlay() {
+  if (updater_) updater_->SetOverlay(new FrameOverlay(overlay_));
+}
+
 uint64_t RGBMatrix::Impl::AwaitInputChange(int timeout_ms) {
   if (!updater_) return 0;
   return updater_->AwaitInputChange(timeout_ms);
 }
 
 bool RGBMatrix::Impl::SetPWMBits(uint8_t value) {
-  const bool success = active_->framebuffer()->SetPWMBits(value);
+  // The active canvas is (or is about to be) shown, so compact bitplanes
+  // must not be re-arranged under the refresh thread; that happens once a
+  // swap hands the canvas back.
+  const bool success = active_->framebuffer()->SetPWMBitsKeepLayout(value);
   if (success) {
     params_.pwm_bits = value;
   }
@@ -558,6 +890,10 @@ uint8_t RGBMatrix::Impl::pwmbits() { return params_.pwm_bits; }
 void RGBMatrix::Impl::set_luminance_correct(bool on) {
   active_->framebuffer()->set_luminance_correct(on);
   do_luminance_correct_ = on;
+  if (!overlay_.empty()) {
+    active_->framebuffer()->RemapOverlay(&overlay_);
+    PublishOverlay();
+  }
 }
 bool RGBMatrix::Impl::luminance_correct() const {
   return do_luminance_correct_;
@@ -568,12 +904,27 @@ void RGBMatrix::Impl::SetBrightness(uint8_t brightness) {
     created_frames_[i]->framebuffer()->SetBrightness(brightness);
   }
   params_.brightness = brightness;
+  if (!overlay_.empty()) {
+    active_->framebuffer()->RemapOverlay(&overlay_);
+    PublishOverlay();
+  }
 }
 
 uint8_t RGBMatrix::Impl::brightness() {
   return params_.brightness;
 }
 
+void RGBMatrix::Impl::SetRefreshRateLimit(int limit_refresh_rate_hz) {
+  params_.limit_refresh_rate_hz = (limit_refresh_rate_hz > 0
+                                   ? limit_refresh_rate_hz : 0);
+  if (updater_) updater_->SetRefreshRateLimit(params_.limit_refresh_rate_hz);
+}
+
+void RGBMatrix::Impl::SetBusyWaiting(bool allow_busy_waiting) {
+  params_.disable_busy_waiting = !allow_busy_waiting;
+  if (updater_) updater_->SetBusyWaiting(allow_busy_waiting);
+}
+
 bool RGBMatrix::Impl::ApplyPixelMapper(const PixelMapper *mapper) {
   if (mapper == NULL) return true;
   using internal::PixelDesignatorMap;
@@ -603,6 +954,13 @@ bool RGBMatrix::Impl::ApplyPixelMapper(const PixelMapper *mapper) {
   }
   delete shared_pixel_mapper_;
   shared_pixel_mapper_ = new_mapper;
+  for (size_t i = 0; i < created_frames_.size(); ++i) {
+    created_frames_[i]->framebuffer()->ResetShadow();
+  }
+  if (!overlay_.empty()) {
+    active_->framebuffer()->RemapOverlay(&overlay_);
+    PublishOverlay();
+  }
   return true;
 }
 
@@ -718,6 +1076,11 @@ FrameCanvas *RGBMatrix::SwapOnVSync(FrameCanvas *other,
                                     unsigned framerate_fraction) {
   return impl_->SwapOnVSync(other, framerate_fraction);
 }
+
+FrameCanvas *RGBMatrix::TrySwapOnVSync(FrameCanvas *other,
+                                       unsigned framerate_fraction) {
+  return impl_->TrySwapOnVSync(other, framerate_fraction);
+}
 bool RGBMatrix::ApplyPixelMapper(const PixelMapper *mapper) {
   return impl_->ApplyPixelMapper(mapper);
 }
@@ -734,6 +1097,16 @@ void RGBMatrix::SetBrightness(uint8_t brightness) {
 }
 uint8_t RGBMatrix::brightness() { return impl_->brightness(); }
 
+void RGBMatrix::SetRefreshRateLimit(int limit_refresh_rate_hz) {
+  impl_->SetRefreshRateLimit(limit_refresh_rate_hz);
+}
+int RGBMatrix::refresh_rate_limit() { return impl_->refresh_rate_limit(); }
+
+void RGBMatrix::SetBusyWaiting(bool allow_busy_waiting) {
+  impl_->SetBusyWaiting(allow_busy_waiting);
+}
+bool RGBMatrix::busy_waiting() { return impl_->busy_waiting(); }
+
 uint64_t RGBMatrix::RequestInputs(uint64_t all_interested_bits) {
   return impl_->RequestInputs(all_interested_bits);
 }
@@ -741,6 +1114,27 @@ uint64_t RGBMatrix::AwaitInputChange(int timeout_ms) {
   return impl_->AwaitInputChange(timeout_ms);
 }
 
+bool RGBMatrix::GetRefreshStats(RefreshStats *stats) {
+  return impl_->GetRefreshStats(stats);
+}
+
+void RGBMatrix::ResetRefreshStats() {
+  impl_->ResetRefreshStats();
+}
+
+bool RGBMatrix::GetFrameClock(uint64_t *frame_count, float *frame_usec) {
+  return impl_->GetFrameClock(frame_count, frame_usec);
+}
+
+void RGBMatrix::SetOverlayPixel(int x, int y,
+                                uint8_t red, uint8_t green, uint8_t blue) {
+  impl_->SetOverlayPixel(x, y, red, green, blue);
+}
+void RGBMatrix::ClearOverlayPixel(int x, int y) {
+  impl_->ClearOverlayPixel(x, y);
+}
+void RGBMatrix::ClearOverlay() { impl_->ClearOverlay(); }
+
 uint64_t RGBMatrix::RequestOutputs(uint64_t all_interested_bits) {
   return impl_->RequestOutputs(all_interested_bits);
 }
@@ -763,6 +1157,16 @@ void RGBMatrix::SetPixel(int x, int y, uint8_t red, uint8_t green, uint8_t blue)
   impl_->active_->SetPixel(x, y, red, green, blue);
 }
 
+void RGBMatrix::SetPixelRun(int x, int y, int length,
+                            uint8_t red, uint8_t green, uint8_t blue) {
+  impl_->active_->SetPixelRun(x, y, length, red, green, blue);
+}
+
+void RGBMatrix::SetPixels(int x, int y, int width, int height,
+                          Color *colors) {
+  impl_->active_->SetPixels(x, y, width, height, colors);
+}
+
 void RGBMatrix::Clear() {
   impl_->active_->Clear();
 }
@@ -779,6 +1183,10 @@ void FrameCanvas::SetPixel(int x, int y,
                          uint8_t red, uint8_t green, uint8_t blue) {
   frame_->SetPixel(x, y, red, green, blue);
 }
+void FrameCanvas::SetPixelRun(int x, int y, int length,
+                              uint8_t red, uint8_t green, uint8_t blue) {
+  frame_->SetPixelRun(x, y, length, red, green, blue);
+}
 void FrameCanvas::SetPixels(int x, int y, int width, int height,
                          Color *colors) {
   frame_->SetPixels(x, y, width, height, colors);
@@ -789,6 +1197,14 @@ void FrameCanvas::Fill(uint8_t red, uint8_t green, uint8_t blue) {
 }
 bool FrameCanvas::SetPWMBits(uint8_t value) { return frame_->SetPWMBits(value); }
 uint8_t FrameCanvas::pwmbits() { return frame_->pwmbits(); }
+uint8_t FrameCanvas::RequiredPWMBits(uint8_t r, uint8_t g, uint8_t b) const {
+  return frame_->RequiredPWMBits(r, g, b);
+}
+bool FrameCanvas::GetPixel(int x, int y,
+                           uint8_t *red, uint8_t *green, uint8_t *blue) const {
+  return frame_->GetPixel(x, y, red, green, blue);
+}
+bool FrameCanvas::Reencode() { return frame_->Reencode(); }
 
 // Map brightness of output linearly to input with CIE1931 profile.
 void FrameCanvas::set_luminance_correct(bool on) { frame_->set_luminance_correct(on); }
@@ -806,4 +1222,8 @@ bool FrameCanvas::Deserialize(const char *data, size_t len) {
 void FrameCanvas::CopyFrom(const FrameCanvas &other) {
   frame_->CopyFrom(other.frame_);
 }
+void FrameCanvas::CopyFrom(const FrameCanvas &other,
+                           int x, int y, int width, int height) {
+  frame_->CopyFrom(other.frame_, x, y, width, height);
+}
 }  // end namespace rgb_matrix
@@ -186,10 +186,17 @@ static bool FlagInit(int &argc, char **&argv,
       if (ConsumeIntFlag("limit-refresh", it, end,
                          &mopts->limit_refresh_rate_hz, &err))
         continue;
+      if (ConsumeIntFlag("pwm-auto-tune", it, end,
+                         &mopts->pwm_auto_tune_hz, &err))
+        continue;
       if (ConsumeBoolFlag("show-refresh", it, &mopts->show_refresh_rate))
         continue;
       if (ConsumeBoolFlag("inverse", it, &mopts->inverse_colors))
         continue;
+      if (ConsumeBoolFlag("compact-bitplanes", it, &mopts->compact_bitplanes))
+        continue;
+      if (ConsumeBoolFlag("rgb-shadow", it, &mopts->rgb_shadow))
+        continue;
       // We don't have a swap_green_blue option anymore, but we simulate the
       // flag for a while.
       bool swap_green_blue;
@@ -343,9 +350,13 @@ void PrintMatrixFlags(FILE *out, const RGBMatrix::Options &d,
           "(Default: %d)\n"
           "\t--led-pwm-dither-bits=<0..2> : Time dithering of lower bits "
           "(Default: 0)\n"
+          "\t--led-pwm-auto-tune=<Hz>  : Show fewer PWM bits if needed to refresh at least at\n"
+          "\t                            this rate. 0=off. Default: %d\n"
           "\t--led-%shardware-pulse   : %sse hardware pin-pulse generation.\n"
           "\t--led-panel-type=<name>   : Needed to initialize special panels. Supported: 'FM6126A', 'FM6127'\n"
-          "\t--led-%sbusy-waiting     : %sse busy waiting when limiting refresh rate.\n",
+          "\t--led-%sbusy-waiting     : %sse busy waiting when limiting refresh rate.\n"
+          "\t--led-%scompact-bitplanes   : %s.\n"
+          "\t--led-%srgb-shadow          : %s.\n",
           d.hardware_mapping,
           d.rows, d.cols, d.chain_length, d.parallel,
           (int) muxers.size(), CreateAvailableMultiplexString(muxers).c_str(),
@@ -356,10 +367,17 @@ void PrintMatrixFlags(FILE *out, const RGBMatrix::Options &d,
           d.limit_refresh_rate_hz,
           d.inverse_colors ? "no-" : "",    d.inverse_colors ? "off" : "on",
           d.pwm_lsb_nanoseconds,
+          d.pwm_auto_tune_hz,
           !d.disable_hardware_pulsing ? "no-" : "",
           !d.disable_hardware_pulsing ? "Don't u" : "U",
           !d.disable_busy_waiting ? "no-" : "",
-          !d.disable_busy_waiting ? "Don't u" : "U");
+          !d.disable_busy_waiting ? "Don't u" : "U",
+          d.compact_bitplanes ? "no-" : "",
+          d.compact_bitplanes ? "Store all bitplanes"
+                              : "Only store bitplanes shown with PWM bits",
+          d.rgb_shadow ? "no-" : "",
+          d.rgb_shadow ? "Don't keep the colors of each pixel"
+                       : "Keep the colors of each pixel for read back");
 
   fprintf(out,
           "\t--led-slowdown-gpio=<%d..4>: "
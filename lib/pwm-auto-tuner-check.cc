@@ -0,0 +1,257 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+// Trace-driven check of the PwmAutoTuner timing model; not part of the
+// library. Run with 'make check'.
+//
+// Without arguments, replays synthetic frame-time traces: frames as the
+// model predicts them for a known clock time, plus the jitter and
+// interruptions a refresh thread sees. Checks that the windowed fit learns
+// the clock time and the overhead, that more PWM bits are only shown with
+// 10% margin, and that the rate reached is at least the target.
+//
+// With a file argument, replays a recorded trace instead and prints every
+// decision. Each line is "<first shown plane> <frame usec>", e.g. from
+// logging what RGBMatrix feeds to PwmAutoTuner::Observe(); lines starting
+// with '#' are comments.
+//   pwm-auto-tuner-check [-r <double-rows>] [-l <pwm-lsb-ns>]
+//                        [-d <dither-bits>] [-t <target-hz>] [trace-file]
+
+#include "check-internal.h"
+#include "pwm-auto-tuner.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <stdint.h>
+
+#include <algorithm>
+
+using rgb_matrix::internal::Framebuffer;
+using rgb_matrix::internal::PwmAutoTuner;
+
+static const int kBitPlanes = Framebuffer::kBitPlanes;
+static const int kWindow = 64;  // Frames per decision in the tuner.
+static const float kMargin = 1.05f;  // Room the tuner leaves to the target.
+
+// The panel the synthetic traces are for: 1:16 multiplexing, default
+// --led-pwm-lsb-nanoseconds, no dithering.
+static const int kDoubleRows = 16;
+static const int kLsbNanos = 130;
+static const int kDitherBits = 0;
+
+// The model written down independently of the tuner: every double row shows
+// each plane for the longer of clocking in the row and its pulse.
+static float ModelFrameUsec(int first_plane, float clock_usec) {
+  float pulse_usec = kLsbNanos / 1000.0f;
+  float row_usec = 0;
+  for (int p = 0; p < kBitPlanes; ++p) {
+    if (p >= first_plane) row_usec += std::max(clock_usec, pulse_usec);
+    if (p >= kDitherBits) pulse_usec *= 2;
+  }
+  return kDoubleRows * row_usec;
+}
+
+// Deterministic jitter: mostly a few microseconds, sometimes an interrupt
+// or a preempted refresh thread that adds a lot more.
+static const int kTypicalJitterUsec = 20;
+static uint32_t Jitter(unsigned *seed) {
+  const int r = rand_r(seed) % 100;
+  if (r < 5) return 500 + rand_r(seed) % 3000;
+  return rand_r(seed) % kTypicalJitterUsec;
+}
+
+// Feed one decision window of frames for "clock_usec", showing the tuner's
+// current bits. Returns if the tuner changed its bits. Adds the time the
+// frames took to "total_usec", if not NULL.
+static bool FeedWindow(PwmAutoTuner *tuner, float clock_usec,
+                       unsigned *seed, uint64_t *total_usec = NULL) {
+  bool changed = false;
+  for (int i = 0; i < kWindow; ++i) {
+    const int first_plane = kBitPlanes - tuner->pwm_bits();
+    // The first frame of every window is undisturbed, so the fit has
+    // something to find.
+    const uint32_t jitter = (i == 0) ? 0 : Jitter(seed);
+    const uint32_t usec = lroundf(ModelFrameUsec(first_plane, clock_usec))
+      + jitter;
+    changed |= tuner->Observe(first_plane, usec);
+    if (total_usec) *total_usec += usec;
+  }
+  return changed;
+}
+
+// Target refresh rate at which "bits" PWM bits take "fraction" of the
+// frame time with "clock_usec".
+static int TargetHz(int bits, float clock_usec, float fraction) {
+  return lroundf(1e6f * fraction
+                 / ModelFrameUsec(kBitPlanes - bits, clock_usec));
+}
+
+static void CheckWindowedFit() {
+  unsigned seed = 1;
+  const float clock_usec = 2.0f;  // Longer than the first few pulses.
+  PwmAutoTuner tuner(kDoubleRows, kLsbNanos, kDitherBits, kBitPlanes, 100);
+  for (int i = 0; i < kWindow - 1; ++i) {
+    tuner.Observe(0, lroundf(ModelFrameUsec(0, clock_usec)) + Jitter(&seed));
+  }
+  CHECK(tuner.clock_usec() < 0, "decided after %d frames", kWindow - 1);
+  tuner.Observe(0, lroundf(ModelFrameUsec(0, clock_usec)));
+  // The fit may include the jitter most frames see, but no less and no
+  // more; up to what a frame time rounded to microseconds can hide.
+  const float model_usec = ModelFrameUsec(0, clock_usec);
+  CHECK(tuner.clock_usec() > 0.99f * clock_usec
+        && tuner.PredictFrameUsec(0) < model_usec + kTypicalJitterUsec,
+        "learned %.3fusec, predicting %.0fusec; expected %.3fusec, %.0fusec",
+        tuner.clock_usec(), tuner.PredictFrameUsec(0), clock_usec, model_usec);
+
+  // Interruptions must not make the clock look slower, but be counted as
+  // overhead that comes on top of any frame.
+  uint64_t total_usec = 0;
+  for (int w = 0; w < 4; ++w) {
+    total_usec = 0;
+    FeedWindow(&tuner, clock_usec, &seed, &total_usec);
+  }
+  CHECK(tuner.clock_usec() > 0.99f * clock_usec
+        && tuner.PredictFrameUsec(0) < model_usec + kTypicalJitterUsec,
+        "drifted to %.3fusec, predicting %.0fusec; expected %.3fusec, %.0fusec",
+        tuner.clock_usec(), tuner.PredictFrameUsec(0), clock_usec, model_usec);
+  const float mean_usec = (float)total_usec / kWindow;
+  CHECK(fabsf(tuner.PredictFrameUsec(0) + tuner.overhead_usec() - mean_usec)
+        < 1.0f, "predicts %.0fusec with overhead, frames took %.0fusec",
+        tuner.PredictFrameUsec(0) + tuner.overhead_usec(), mean_usec);
+
+  // If clocking is hidden behind the pulses, the fit can't see it. All
+  // it knows is that it is not slower than the shortest pulse shown, or
+  // than the jitter of most frames makes it look.
+  PwmAutoTuner hidden(kDoubleRows, kLsbNanos, kDitherBits, kBitPlanes, 100);
+  for (int w = 0; w < 2; ++w) FeedWindow(&hidden, 0.05f, &seed);
+  CHECK(hidden.PredictFrameUsec(0)
+        < ModelFrameUsec(0, 0.05f) + kTypicalJitterUsec,
+        "hidden clock time learned as %.3fusec", hidden.clock_usec());
+}
+
+static void CheckMargin() {
+  unsigned seed = 2;
+  const float fast_usec = 2.0f, slow_usec = 20.0f;
+  // 11 bits fit with room to spare with the fast clock time.
+  const int target_hz = TargetHz(11, fast_usec, 0.75f);
+  PwmAutoTuner tuner(kDoubleRows, kLsbNanos, kDitherBits, kBitPlanes,
+                     target_hz);
+  for (int w = 0; w < 4; ++w) FeedWindow(&tuner, fast_usec, &seed);
+  CHECK(tuner.pwm_bits() == 11, "dropped to %d bits although they fit",
+        tuner.pwm_bits());
+
+  // Clocking gets slower, e.g. another process competes for the bus.
+  for (int w = 0; w < 4; ++w) FeedWindow(&tuner, slow_usec, &seed);
+  const int slow_bits = tuner.pwm_bits();
+  CHECK(slow_bits < 11, "still at %d bits", slow_bits);
+  if (slow_bits >= 11) return;
+  CHECK(ModelFrameUsec(kBitPlanes - slow_bits, slow_usec)
+        + tuner.overhead_usec() <= 1e6f / target_hz / kMargin,
+        "%d bits don't fit the target", slow_bits);
+  CHECK(ModelFrameUsec(kBitPlanes - slow_bits - 1, slow_usec)
+        + tuner.overhead_usec() + kTypicalJitterUsec
+        > 1e6f / target_hz / kMargin, "%d bits would have fit", slow_bits + 1);
+
+  // Somewhat faster: one more bit fits, but by less than the 10% margin,
+  // so the tuner must stay where it is instead of going up and down again.
+  // Find a clock time at which the next step up needs 95% of the frame.
+  float edge_usec = slow_usec;
+  for (float c = slow_usec; c > 0.1f; c -= 0.001f) {
+    if (ModelFrameUsec(kBitPlanes - slow_bits - 1, c) <= 0.95e6f / target_hz) {
+      edge_usec = c;
+      break;
+    }
+  }
+  for (int w = 0; w < 4; ++w) FeedWindow(&tuner, edge_usec, &seed);
+  CHECK(tuner.pwm_bits() == slow_bits,
+        "went from %d to %d bits within the margin",
+        slow_bits, tuner.pwm_bits());
+
+  // With room to spare, it goes all the way up again.
+  for (int w = 0; w < 4; ++w) FeedWindow(&tuner, fast_usec, &seed);
+  CHECK(tuner.pwm_bits() == 11, "stuck at %d bits", tuner.pwm_bits());
+}
+
+// Every frame counts for the rate reached, interrupted or not. At any
+// target that one bit can reach, the tuner must reach it.
+static void CheckAchievedRate() {
+  unsigned seed = 3;
+  const float clock_usec = 3.0f;
+  for (int target_hz = 100; target_hz < 500; target_hz += 10) {
+    PwmAutoTuner tuner(kDoubleRows, kLsbNanos, kDitherBits, kBitPlanes,
+                       target_hz);
+    for (int w = 0; w < 4; ++w) FeedWindow(&tuner, clock_usec, &seed);
+    uint64_t total_usec = 0;
+    for (int w = 0; w < 16; ++w)
+      FeedWindow(&tuner, clock_usec, &seed, &total_usec);
+    const float achieved_hz = 16 * kWindow * 1e6f / total_usec;
+    CHECK(achieved_hz >= target_hz || tuner.pwm_bits() == 1,
+          "target %dHz: %d bits reach %.1fHz", target_hz, tuner.pwm_bits(),
+          achieved_hz);
+  }
+}
+
+static int usage(const char *progname) {
+  fprintf(stderr, "usage: %s [-r <double-rows>] [-l <pwm-lsb-ns>] "
+          "[-d <dither-bits>] [-t <target-hz>] [trace-file]\n", progname);
+  return 1;
+}
+
+static int ReplayTrace(const char *filename, int double_rows, int lsb_nanos,
+                       int dither_bits, int target_hz) {
+  FILE *f = fopen(filename, "r");
+  if (f == NULL) {
+    perror(filename);
+    return 1;
+  }
+  PwmAutoTuner tuner(double_rows, lsb_nanos, dither_bits, kBitPlanes,
+                     target_hz);
+  char line[256];
+  int frame = 0;
+  while (fgets(line, sizeof(line), f)) {
+    int first_plane;
+    unsigned usec;
+    if (line[0] == '#' || sscanf(line, "%d %u", &first_plane, &usec) != 2)
+      continue;
+    ++frame;
+    if (tuner.Observe(first_plane, usec) || frame % kWindow == 0) {
+      printf("frame %6d: clock %.3fusec, overhead %.0fusec, %2d bits, "
+             "predicted %.0fusec\n", frame, tuner.clock_usec(),
+             tuner.overhead_usec(), tuner.pwm_bits(),
+             tuner.PredictFrameUsec(kBitPlanes - tuner.pwm_bits())
+             + tuner.overhead_usec());
+    }
+  }
+  fclose(f);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  int double_rows = kDoubleRows;
+  int lsb_nanos = kLsbNanos;
+  int dither_bits = kDitherBits;
+  int target_hz = 100;
+  int opt;
+  while ((opt = getopt(argc, argv, "r:l:d:t:")) != -1) {
+    switch (opt) {
+    case 'r': double_rows = atoi(optarg); break;
+    case 'l': lsb_nanos = atoi(optarg); break;
+    case 'd': dither_bits = atoi(optarg); break;
+    case 't': target_hz = atoi(optarg); break;
+    default: return usage(argv[0]);
+    }
+  }
+  if (double_rows < 1 || lsb_nanos < 1 || target_hz < 1
+      || dither_bits < 0 || dither_bits >= kBitPlanes)
+    return usage(argv[0]);
+  if (optind < argc) {
+    return ReplayTrace(argv[optind], double_rows, lsb_nanos, dither_bits,
+                       target_hz);
+  }
+
+  CheckWindowedFit();
+  CheckMargin();
+  CheckAchievedRate();
+  return CheckSummary("PwmAutoTuner");
+}
@@ -0,0 +1,116 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+
+#include "pwm-auto-tuner.h"
+
+#include <algorithm>
+
+namespace rgb_matrix {
+namespace internal {
+static const int kBitPlanes = Framebuffer::kBitPlanes;
+
+// Decide only every so many frames. The clock time is learned from the
+// frame at this percentile of such a window: the fastest one would take
+// the jitter every frame sees as part of the pulses and so be optimistic.
+// The rare frames above it, e.g. while the refresh thread was interrupted,
+// count as overhead instead, as they take the same time with any bits.
+static const int kDecisionFrames = 64;
+static const int kFitPercentile = 90;
+
+// The bits shown must fit the target frame time with this much to spare,
+// as windows vary.
+static const float kMargin = 1.05f;
+
+// Only show more bits if the prediction is this much faster still;
+// avoids flipping back and forth at the edge.
+static const float kIncreaseMargin = 1.1f;
+
+PwmAutoTuner::PwmAutoTuner(int double_rows, int pwm_lsb_nanoseconds,
+                           int dither_bits, int max_pwm_bits, int target_hz)
+  : double_rows_(double_rows), max_pwm_bits_(max_pwm_bits),
+    target_frame_usec_(1e6f / target_hz),
+    clock_usec_(-1), overhead_usec_(0), pwm_bits_(max_pwm_bits),
+    window_bound_usec_(0) {
+  window_.reserve(kDecisionFrames);
+  window_clock_usec_.reserve(kDecisionFrames);
+  // Same as the bitplane timings in Framebuffer::InitGPIO().
+  float timing_usec = pwm_lsb_nanoseconds / 1000.0f;
+  for (int b = 0; b < kBitPlanes; ++b) {
+    pulse_usec_[b] = timing_usec;
+    if (b >= dither_bits) timing_usec *= 2;
+  }
+}
+
+float PwmAutoTuner::PredictFrameUsec(int first_plane, float clock_usec) const {
+  float row_usec = 0;
+  for (int p = std::max(first_plane, 0); p < kBitPlanes; ++p) {
+    row_usec += std::max(clock_usec, pulse_usec_[p]);
+  }
+  return double_rows_ * row_usec;
+}
+
+// The clock time that explains the observed frame time. The prediction is
+// monotonic in the clock time, so bisect.
+float PwmAutoTuner::FitClockUsec(int first_plane, uint32_t frame_usec) const {
+  if (PredictFrameUsec(first_plane, pulse_usec_[first_plane]) >= frame_usec)
+    return 0;  // Explained by the pulses alone; clock time is hidden.
+  float low = 0, high = (float)frame_usec / double_rows_;
+  for (int i = 0; i < 20; ++i) {
+    const float mid = (low + high) / 2;
+    if (PredictFrameUsec(first_plane, mid) < frame_usec)
+      low = mid;
+    else
+      high = mid;
+  }
+  return (low + high) / 2;
+}
+
+int PwmAutoTuner::BestPwmBits() const {
+  for (int bits = max_pwm_bits_; bits > 1; --bits) {
+    float allowed_usec = target_frame_usec_ / kMargin;
+    if (bits > pwm_bits_) allowed_usec /= kIncreaseMargin;
+    if (PredictFrameUsec(kBitPlanes - bits) + overhead_usec_ <= allowed_usec)
+      return bits;
+  }
+  return 1;
+}
+
+bool PwmAutoTuner::Observe(int first_plane, uint32_t frame_usec) {
+  if (first_plane < 0) first_plane = 0;
+  if (first_plane >= kBitPlanes) first_plane = kBitPlanes - 1;
+  const Observation observation = {
+    first_plane, frame_usec, FitClockUsec(first_plane, frame_usec)
+  };
+  window_.push_back(observation);
+  if (observation.clock_usec == 0) {
+    // All we know is that clocking is not slower than the shortest pulse.
+    window_bound_usec_ = pulse_usec_[first_plane];
+  }
+
+  if ((int)window_.size() < kDecisionFrames)
+    return false;
+  window_clock_usec_.clear();
+  for (const Observation &o : window_)
+    window_clock_usec_.push_back(o.clock_usec);
+  const std::vector<float>::iterator fit =
+    window_clock_usec_.begin() + kDecisionFrames * kFitPercentile / 100;
+  std::nth_element(window_clock_usec_.begin(), fit, window_clock_usec_.end());
+  if (*fit > 0) {
+    clock_usec_ = *fit;
+  } else if (clock_usec_ < 0 || clock_usec_ > window_bound_usec_) {
+    clock_usec_ = window_bound_usec_;  // Be pessimistic.
+  }
+  float overhead_usec = 0;
+  for (const Observation &o : window_) {
+    overhead_usec += o.frame_usec - PredictFrameUsec(o.first_plane);
+  }
+  overhead_usec_ = std::max(overhead_usec / kDecisionFrames, 0.0f);
+  window_.clear();
+  const int best = BestPwmBits();
+  if (best == pwm_bits_)
+    return false;
+  pwm_bits_ = best;
+  return true;
+}
+
+}  // namespace internal
+}  // namespace rgb_matrix
@@ -0,0 +1,81 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+#ifndef RPI_RGBMATRIX_PWM_AUTO_TUNER_H
+#define RPI_RGBMATRIX_PWM_AUTO_TUNER_H
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "framebuffer-internal.h"
+
+namespace rgb_matrix {
+namespace internal {
+
+// Chooses how many PWM bits to show to keep the refresh rate at or above
+// a target, from observed frame times.
+//
+// Model: for every double row, each shown bitplane p takes the longer of
+// clocking in one row of data (unknown, learned from observations) and
+// its output-enable pulse, which is pwm_lsb_nanoseconds * 2^(p - dither)
+// as set up in Framebuffer::InitGPIO(). So
+//
+//   frame_usec(planes) = double_rows * sum(max(clock_usec, pulse_usec(p)))
+//                        + overhead_usec
+//
+// where overhead_usec is what frames took on average beyond that, e.g.
+// while the refresh thread was interrupted.
+//
+// Only depends on what it is fed, no clock or threads, so it can be driven
+// from recorded frame-time traces.
+class PwmAutoTuner {
+public:
+  PwmAutoTuner(int double_rows, int pwm_lsb_nanoseconds, int dither_bits,
+               int max_pwm_bits, int target_hz);
+
+  // Feed the time DumpToMatrix() took to show bitplanes first_plane..10,
+  // not counting any waiting for a refresh limit. Returns true if this
+  // changed pwm_bits().
+  bool Observe(int first_plane, uint32_t frame_usec);
+
+  // Number of PWM bits to show; starts with max_pwm_bits.
+  int pwm_bits() const { return pwm_bits_; }
+
+  // Currently learned time to clock in one row of one bitplane.
+  float clock_usec() const { return clock_usec_; }
+
+  // Currently learned average time a frame takes beyond the model.
+  float overhead_usec() const { return overhead_usec_; }
+
+  // Predicted time of a frame showing planes first_plane..10, not counting
+  // the overhead.
+  float PredictFrameUsec(int first_plane) const {
+    return PredictFrameUsec(first_plane, clock_usec_);
+  }
+
+private:
+  float PredictFrameUsec(int first_plane, float clock_usec) const;
+  float FitClockUsec(int first_plane, uint32_t frame_usec) const;
+  int BestPwmBits() const;
+
+  const int double_rows_;
+  const int max_pwm_bits_;
+  const float target_frame_usec_;
+  float pulse_usec_[Framebuffer::kBitPlanes];
+  float clock_usec_;       // < 0 until the first decision.
+  float overhead_usec_;
+  int pwm_bits_;
+
+  // Since the last decision.
+  struct Observation {
+    int first_plane;
+    uint32_t frame_usec;
+    float clock_usec;      // Fit of this frame alone.
+  };
+  std::vector<Observation> window_;
+  std::vector<float> window_clock_usec_;     // Scratch space for the fit.
+  float window_bound_usec_;  // Upper bound if clocking was hidden by pulses.
+};
+
+}  // namespace internal
+}  // namespace rgb_matrix
+#endif  // RPI_RGBMATRIX_PWM_AUTO_TUNER_H